@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#if defined( _MSC_VER )
+#include <malloc.h>
+#endif
+
+static const size_t CacheLineSize = 64;
+
+inline void* AlignedAlloc( const size_t size, const size_t alignment )
+{
+#if defined( _MSC_VER )
+	return _aligned_malloc( size, alignment );
+#else
+	const size_t paddedSize = ( ( size + alignment - 1 ) / alignment ) * alignment;
+	return aligned_alloc( alignment, paddedSize );
+#endif
+}
+
+
+inline void AlignedFree( void* ptr )
+{
+#if defined( _MSC_VER )
+	_aligned_free( ptr );
+#else
+	free( ptr );
+#endif
+}
+
+
+// std::allocator does not honor over-aligned types before C++17
+template<typename T, size_t Alignment = CacheLineSize>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef AlignedAllocator<U, Alignment> other;
+	};
+
+	AlignedAllocator() noexcept {}
+
+	template<typename U>
+	AlignedAllocator( const AlignedAllocator<U, Alignment>& ) noexcept {}
+
+	T* allocate( const size_t n )
+	{
+		void* ptr = AlignedAlloc( n * sizeof( T ), Alignment );
+		if ( ptr == nullptr )
+		{
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>( ptr );
+	}
+
+	void deallocate( T* ptr, const size_t ) noexcept
+	{
+		AlignedFree( ptr );
+	}
+};
+
+
+template<typename T, typename U, size_t Alignment>
+inline bool operator==( const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>& )
+{
+	return true;
+}
+
+
+template<typename T, typename U, size_t Alignment>
+inline bool operator!=( const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>& )
+{
+	return false;
+}
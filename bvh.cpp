@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "bvh.h"
+
+// Range of primitives left for a pool task. Its root node is already allocated.
+struct subtreeTask_t
+{
+	uint32_t	nodeIx;
+	uint32_t	first;
+	uint32_t	count;
+	uint32_t	depth;
+};
+
+
+struct buildContext_t
+{
+	const std::vector<AABB>*	primBounds;
+	std::vector<vec3d>			centroids;
+	uint32_t					maxLeafSize;
+	uint32_t					spawnDepth;	// Nodes at this depth become subtree tasks when tasks is set
+	std::vector<subtreeTask_t>*	tasks;
+};
+
+
+struct sahBin_t
+{
+	AABB		bounds;
+	uint32_t	count;
+};
+
+
+static double SurfaceArea( const AABB& box )
+{
+	const vec3d d = box.max - box.min;
+	return 2.0 * ( d[ 0 ] * d[ 1 ] + d[ 1 ] * d[ 2 ] + d[ 2 ] * d[ 0 ] );
+}
+
+
+static void ExpandBounds( AABB& bounds, const AABB& box )
+{
+	bounds.Expand( box.min );
+	bounds.Expand( box.max );
+}
+
+
+// Conversions round outward so a narrower node still encloses everything below it
+template<typename T>
+static T RoundDown( const double x )
+{
+	const T r = static_cast<T>( x );
+	return ( r > x ) ? std::nextafter( r, -std::numeric_limits<T>::max() ) : r;
+}
+
+
+template<typename T>
+static T RoundUp( const double x )
+{
+	const T r = static_cast<T>( x );
+	return ( r < x ) ? std::nextafter( r, std::numeric_limits<T>::max() ) : r;
+}
+
+
+template<typename T>
+static void SetNodeBounds( bvhNode_t<T>& node, const AABB& bounds )
+{
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		node.boundsMin[ i ] = RoundDown<T>( bounds.min[ i ] );
+		node.boundsMax[ i ] = RoundUp<T>( bounds.max[ i ] );
+	}
+}
+
+
+static uint32_t BinIndex( const double centroid, const double centroidMin, const double binScale )
+{
+	const uint32_t binIx = static_cast<uint32_t>( ( centroid - centroidMin ) * binScale );
+	return std::min( binIx, BvhSahBinCnt - 1 );
+}
+
+
+// Subtrees only touch their own range of indices, so concurrent builds can share it.
+// Each writes its nodes to its own array.
+template<typename T>
+static void BuildRecursive( buildContext_t& ctx, typename BVH<T>::nodeArray_t& nodes, std::vector<uint32_t>& indices, const uint32_t nodeIx, const uint32_t first, const uint32_t count, const uint32_t depth )
+{
+	if ( ( ctx.tasks != nullptr ) && ( depth == ctx.spawnDepth ) )
+	{
+		ctx.tasks->push_back( { nodeIx, first, count, depth } );
+		return;
+	}
+
+	const std::vector<AABB>& primBounds = *ctx.primBounds;
+	const uint32_t last = first + count;
+
+	AABB bounds;
+	AABB centroidBounds;
+	for ( uint32_t i = first; i < last; ++i )
+	{
+		const uint32_t primIx = indices[ i ];
+		ExpandBounds( bounds, primBounds[ primIx ] );
+		centroidBounds.Expand( ctx.centroids[ primIx ] );
+	}
+	SetNodeBounds( nodes[ nodeIx ], bounds );
+
+	if ( ( count == 1 ) || ( depth >= ( BvhMaxDepth - 2 ) ) )
+	{
+		nodes[ nodeIx ].offset = first;
+		nodes[ nodeIx ].count = count;
+		return;
+	}
+
+	// Binned SAH: cost = traversal + sum( area( child ) / area( parent ) * count( child ) )
+	const double leafCost = static_cast<double>( count );
+	const double parentArea = SurfaceArea( bounds );
+
+	double bestCost = DBL_MAX;
+	int32_t bestAxis = -1;
+	uint32_t bestBin = 0;
+
+	for ( int32_t axis = 0; axis < 3; ++axis )
+	{
+		const double extent = centroidBounds.max[ axis ] - centroidBounds.min[ axis ];
+		if ( extent <= 0.0 )
+		{
+			continue;
+		}
+
+		const double binScale = BvhSahBinCnt / extent;
+
+		sahBin_t bins[ BvhSahBinCnt ];
+		for ( uint32_t b = 0; b < BvhSahBinCnt; ++b )
+		{
+			bins[ b ].count = 0;
+		}
+
+		for ( uint32_t i = first; i < last; ++i )
+		{
+			const uint32_t primIx = indices[ i ];
+			sahBin_t& bin = bins[ BinIndex( ctx.centroids[ primIx ][ axis ], centroidBounds.min[ axis ], binScale ) ];
+			ExpandBounds( bin.bounds, primBounds[ primIx ] );
+			++bin.count;
+		}
+
+		// Sweep from the right to get the cost of every right-hand partition
+		double rightArea[ BvhSahBinCnt ];
+		uint32_t rightCount[ BvhSahBinCnt ];
+		AABB rightBounds;
+		uint32_t rightSum = 0;
+		for ( uint32_t b = BvhSahBinCnt - 1; b > 0; --b )
+		{
+			if ( bins[ b ].count > 0 )
+			{
+				ExpandBounds( rightBounds, bins[ b ].bounds );
+				rightSum += bins[ b ].count;
+			}
+			rightCount[ b ] = rightSum;
+			rightArea[ b ] = ( rightSum > 0 ) ? SurfaceArea( rightBounds ) : 0.0;
+		}
+
+		AABB leftBounds;
+		uint32_t leftSum = 0;
+		for ( uint32_t b = 0; b < ( BvhSahBinCnt - 1 ); ++b )
+		{
+			if ( bins[ b ].count > 0 )
+			{
+				ExpandBounds( leftBounds, bins[ b ].bounds );
+				leftSum += bins[ b ].count;
+			}
+
+			if ( ( leftSum == 0 ) || ( rightCount[ b + 1 ] == 0 ) )
+			{
+				continue;
+			}
+
+			const double leftArea = SurfaceArea( leftBounds );
+			const double cost = 1.0 + ( leftArea * leftSum + rightArea[ b + 1 ] * rightCount[ b + 1 ] ) / parentArea;
+			if ( cost < bestCost )
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	if ( ( count <= ctx.maxLeafSize ) && ( ( bestAxis < 0 ) || ( bestCost >= leafCost ) ) )
+	{
+		nodes[ nodeIx ].offset = first;
+		nodes[ nodeIx ].count = count;
+		return;
+	}
+
+	uint32_t splitCount = 0;
+	if ( bestAxis >= 0 )
+	{
+		const double centroidMin = centroidBounds.min[ bestAxis ];
+		const double binScale = BvhSahBinCnt / ( centroidBounds.max[ bestAxis ] - centroidMin );
+
+		auto begin = indices.begin() + first;
+		auto mid = std::partition( begin, begin + count, [&]( const uint32_t primIx ) {
+			return BinIndex( ctx.centroids[ primIx ][ bestAxis ], centroidMin, binScale ) <= bestBin;
+		} );
+		splitCount = static_cast<uint32_t>( mid - begin );
+	}
+
+	// Coincident centroids leave nothing to split on; halve the range to respect the leaf size
+	if ( ( splitCount == 0 ) || ( splitCount == count ) )
+	{
+		splitCount = count / 2;
+	}
+
+	const uint32_t leftIx = static_cast<uint32_t>( nodes.size() );
+	nodes.resize( nodes.size() + 2 );
+
+	nodes[ nodeIx ].offset = leftIx;
+	nodes[ nodeIx ].count = 0;
+
+	BuildRecursive<T>( ctx, nodes, indices, leftIx, first, splitCount, depth + 1 );
+	BuildRecursive<T>( ctx, nodes, indices, leftIx + 1, first + splitCount, count - splitCount, depth + 1 );
+}
+
+
+// Moves a subtree built with its root at local index 0 into the tree. The root takes the slot
+// reserved for it and the rest is appended, with child offsets rebased to match.
+template<typename T>
+static void AppendSubtree( typename BVH<T>::nodeArray_t& nodes, const uint32_t rootIx, const typename BVH<T>::nodeArray_t& subtree )
+{
+	const uint32_t base = static_cast<uint32_t>( nodes.size() ) - 1;
+	const size_t subtreeSize = subtree.size();
+	for ( size_t i = 0; i < subtreeSize; ++i )
+	{
+		bvhNode_t<T> node = subtree[ i ];
+		if ( node.count == 0 )
+		{
+			node.offset += base;
+		}
+
+		if ( i == 0 )
+		{
+			nodes[ rootIx ] = node;
+		}
+		else
+		{
+			nodes.push_back( node );
+		}
+	}
+}
+
+
+template<typename T>
+void BVH<T>::Build( const std::vector<AABB>& primBounds, const uint32_t maxLeafSize, ThreadPool* pool )
+{
+	nodes.clear();
+	indices.clear();
+
+	const uint32_t primCnt = static_cast<uint32_t>( primBounds.size() );
+	if ( primCnt == 0 )
+	{
+		return;
+	}
+
+	if ( primCnt < BvhParallelMinPrims )
+	{
+		pool = nullptr;
+	}
+
+	buildContext_t ctx;
+	ctx.primBounds = &primBounds;
+	ctx.maxLeafSize = std::max( 1u, maxLeafSize );
+	ctx.spawnDepth = 0;
+	ctx.tasks = nullptr;
+	ctx.centroids.resize( primCnt );
+
+	indices.resize( primCnt );
+	for ( uint32_t i = 0; i < primCnt; ++i )
+	{
+		indices[ i ] = i;
+		ctx.centroids[ i ] = 0.5 * ( primBounds[ i ].min + primBounds[ i ].max );
+	}
+
+	nodes.reserve( 2 * primCnt - 1 );
+	nodes.resize( 1 );
+
+	if ( pool == nullptr )
+	{
+		BuildRecursive<T>( ctx, nodes, indices, 0, 0, primCnt, 0 );
+		nodes.shrink_to_fit();
+		return;
+	}
+
+	// About four subtrees per worker, so stealing can even out lopsided SAH splits
+	std::vector<subtreeTask_t> tasks;
+	ctx.tasks = &tasks;
+	while ( ( 1u << ctx.spawnDepth ) < 4 * pool->GetWorkerCount() )
+	{
+		++ctx.spawnDepth;
+	}
+	BuildRecursive<T>( ctx, nodes, indices, 0, 0, primCnt, 0 );
+	ctx.tasks = nullptr;
+
+	std::vector<nodeArray_t> subtrees( tasks.size() );
+	pool->ParallelFor( static_cast<uint32_t>( tasks.size() ), [&]( const uint32_t taskIx, const uint32_t workerIx )
+	{
+		const subtreeTask_t& task = tasks[ taskIx ];
+		subtrees[ taskIx ].reserve( 2 * task.count - 1 );
+		subtrees[ taskIx ].resize( 1 );
+		BuildRecursive<T>( ctx, subtrees[ taskIx ], indices, 0, task.first, task.count, task.depth );
+	} );
+
+	for ( size_t i = 0; i < tasks.size(); ++i )
+	{
+		AppendSubtree<T>( nodes, tasks[ i ].nodeIx, subtrees[ i ] );
+	}
+	nodes.shrink_to_fit();
+}
+
+
+template<typename T>
+void BuildTriangleBVH( const std::vector<Triangle>& triCache, BVH<T>& bvh, ThreadPool* pool )
+{
+	const uint32_t triCnt = static_cast<uint32_t>( triCache.size() );
+	std::vector<AABB> triBounds( triCnt );
+
+	auto boundTriangles = [&]( const uint32_t first, const uint32_t last )
+	{
+		for ( uint32_t i = first; i < last; ++i )
+		{
+			const Triangle& tri = triCache[ i ];
+			triBounds[ i ].Expand( Trunc<4, 1>( tri.v0.pos ) );
+			triBounds[ i ].Expand( Trunc<4, 1>( tri.v1.pos ) );
+			triBounds[ i ].Expand( Trunc<4, 1>( tri.v2.pos ) );
+		}
+	};
+
+	if ( ( pool != nullptr ) && ( triCnt >= BvhParallelMinPrims ) )
+	{
+		const uint32_t chunkCnt = ( triCnt + BvhParallelMinPrims - 1 ) / BvhParallelMinPrims;
+		pool->ParallelFor( chunkCnt, [&]( const uint32_t chunkIx, const uint32_t workerIx )
+		{
+			boundTriangles( chunkIx * BvhParallelMinPrims, std::min( ( chunkIx + 1 ) * BvhParallelMinPrims, triCnt ) );
+		} );
+	}
+	else
+	{
+		boundTriangles( 0, triCnt );
+	}
+
+	bvh.Build( triBounds, BvhMaxLeafSize, pool );
+}
+
+
+template class BVH<float>;
+template class BVH<double>;
+template void BuildTriangleBVH( const std::vector<Triangle>& triCache, BVH<float>& bvh, ThreadPool* pool );
+template void BuildTriangleBVH( const std::vector<Triangle>& triCache, BVH<double>& bvh, ThreadPool* pool );
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <float.h>
+#include <limits>
+#include "../GfxCore/mathVector.h"
+#include "../GfxCore/geom.h"
+#include "alignedAllocator.h"
+#include "intersect.h"
+#include "packet.h"
+#include "threadPool.h"
+
+static const uint32_t BvhMaxDepth		= 64;
+static const uint32_t BvhSahBinCnt		= 16;
+static const uint32_t BvhMaxLeafSize	= 8;
+static const uint32_t BvhParallelMinPrims	= 16384;	// Smaller builds aren't worth splitting across the pool
+
+// Siblings are stored next to each other. Double nodes fill a cache line; float nodes share one with their sibling.
+template<typename T>
+struct alignas( 8 * sizeof( T ) ) bvhNode_t
+{
+	T			boundsMin[ 3 ];
+	T			boundsMax[ 3 ];
+	uint32_t	offset;	// Interior: index of first child, second child follows. Leaf: first entry in BVH::indices
+	uint32_t	count;	// Zero for interior nodes
+};
+static_assert( sizeof( bvhNode_t<double> ) == CacheLineSize, "BVH node should fill exactly one cache line" );
+static_assert( 2 * sizeof( bvhNode_t<float> ) == CacheLineSize, "BVH sibling pair should fill exactly one cache line" );
+
+
+template<typename T>
+inline bool IntersectRayAABB( const traceRay_t<T>& ray, const bvhNode_t<T>& node, const T tMax, T& tEntry )
+{
+	T t0 = T( 0 );
+	T t1 = tMax;
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		T tNear = ( node.boundsMin[ i ] - ray.o[ i ] ) * ray.invD[ i ];
+		T tFar = ( node.boundsMax[ i ] - ray.o[ i ] ) * ray.invD[ i ];
+		if ( tNear > tFar )
+		{
+			std::swap( tNear, tFar );
+		}
+		tFar *= traceEpsilon_t<T>::SlabScale;
+		t0 = ( tNear > t0 ) ? tNear : t0;
+		t1 = ( tFar < t1 ) ? tFar : t1;
+		if ( t0 > t1 )
+		{
+			return false;
+		}
+	}
+
+	tEntry = t0;
+	return true;
+}
+
+
+template<typename T>
+class BVH
+{
+public:
+	typedef std::vector<bvhNode_t<T>, AlignedAllocator<bvhNode_t<T>>>	nodeArray_t;
+
+	// Binned surface area heuristic build. Leaves hold at most maxLeafSize primitives.
+	// The build runs in double; node bounds are rounded outward when T is narrower.
+	// Given a pool, the top levels are split serially and the subtrees below them are built as
+	// pool tasks. The pool must not be running a ParallelFor of its own.
+	void Build( const std::vector<AABB>& primBounds, const uint32_t maxLeafSize, ThreadPool* pool = nullptr );
+
+	AABB GetAABB() const
+	{
+		AABB bounds;
+		if ( !nodes.empty() )
+		{
+			bounds.Expand( vec3d( nodes[ 0 ].boundsMin[ 0 ], nodes[ 0 ].boundsMin[ 1 ], nodes[ 0 ].boundsMin[ 2 ] ) );
+			bounds.Expand( vec3d( nodes[ 0 ].boundsMax[ 0 ], nodes[ 0 ].boundsMax[ 1 ], nodes[ 0 ].boundsMax[ 2 ] ) );
+		}
+		return bounds;
+	}
+
+	bool IsEmpty() const
+	{
+		return nodes.empty();
+	}
+
+	// Visits leaves front to back, skipping any node that starts beyond tMax.
+	// The leaf callback is called as leafFunc( nodeIx, tMax ) and may shrink tMax.
+	// Returning true from the callback ends traversal.
+	template<typename LeafFunc>
+	bool TraverseLeaves( const traceRay_t<T>& ray, T& tMax, LeafFunc&& leafFunc ) const;
+
+	// Same as TraverseLeaves, calling leafFunc( primIx, tMax ) for each primitive in a leaf
+	template<typename PrimFunc>
+	bool Traverse( const traceRay_t<T>& ray, T& tMax, PrimFunc&& primFunc ) const;
+
+	// Packet version of TraverseLeaves. A node is visited while any lane can still reach it.
+	// tMax holds one limit per lane and is read again after every leafFunc( nodeIx ) call.
+	template<uint32_t N, typename LeafFunc>
+	void TraversePacketLeaves( const rayPacket_t<N, T>& packet, const T* tMax, LeafFunc&& leafFunc ) const;
+
+	// Same as TraversePacketLeaves, calling primFunc( primIx ) for each primitive in a leaf
+	template<uint32_t N, typename PrimFunc>
+	void TraversePacket( const rayPacket_t<N, T>& packet, const T* tMax, PrimFunc&& primFunc ) const;
+
+	nodeArray_t				nodes;
+	std::vector<uint32_t>	indices;
+};
+
+
+template<typename T>
+void BuildTriangleBVH( const std::vector<Triangle>& triCache, BVH<T>& bvh, ThreadPool* pool = nullptr );
+
+
+template<typename T>
+template<typename LeafFunc>
+bool BVH<T>::TraverseLeaves( const traceRay_t<T>& ray, T& tMax, LeafFunc&& leafFunc ) const
+{
+	if ( nodes.empty() )
+	{
+		return false;
+	}
+
+	struct stackEntry_t
+	{
+		uint32_t	nodeIx;
+		T		tEntry;
+	};
+
+	stackEntry_t stack[ BvhMaxDepth ];
+	uint32_t stackSize = 0;
+
+	T tRoot;
+	if ( !IntersectRayAABB( ray, nodes[ 0 ], tMax, tRoot ) )
+	{
+		return false;
+	}
+	stack[ stackSize++ ] = { 0, tRoot };
+
+	while ( stackSize > 0 )
+	{
+		const stackEntry_t entry = stack[ --stackSize ];
+		if ( entry.tEntry > tMax )
+		{
+			continue;
+		}
+
+		const bvhNode_t<T>& node = nodes[ entry.nodeIx ];
+		if ( node.count > 0 )
+		{
+			if ( leafFunc( entry.nodeIx, tMax ) )
+			{
+				return true;
+			}
+			continue;
+		}
+
+		const uint32_t leftIx = node.offset;
+		const uint32_t rightIx = node.offset + 1;
+
+		T tLeft = std::numeric_limits<T>::max();
+		T tRight = std::numeric_limits<T>::max();
+		const bool hitLeft = IntersectRayAABB( ray, nodes[ leftIx ], tMax, tLeft );
+		const bool hitRight = IntersectRayAABB( ray, nodes[ rightIx ], tMax, tRight );
+
+		// Push the far child first so the near child is popped next
+		if ( hitLeft && hitRight )
+		{
+			if ( tLeft <= tRight )
+			{
+				stack[ stackSize++ ] = { rightIx, tRight };
+				stack[ stackSize++ ] = { leftIx, tLeft };
+			}
+			else
+			{
+				stack[ stackSize++ ] = { leftIx, tLeft };
+				stack[ stackSize++ ] = { rightIx, tRight };
+			}
+		}
+		else if ( hitLeft )
+		{
+			stack[ stackSize++ ] = { leftIx, tLeft };
+		}
+		else if ( hitRight )
+		{
+			stack[ stackSize++ ] = { rightIx, tRight };
+		}
+	}
+
+	return false;
+}
+
+
+template<typename T>
+template<typename PrimFunc>
+bool BVH<T>::Traverse( const traceRay_t<T>& ray, T& tMax, PrimFunc&& primFunc ) const
+{
+	return TraverseLeaves( ray, tMax, [&]( const uint32_t nodeIx, T& tLeaf ) -> bool
+	{
+		const bvhNode_t<T>& node = nodes[ nodeIx ];
+		const uint32_t last = node.offset + node.count;
+		for ( uint32_t i = node.offset; i < last; ++i )
+		{
+			if ( primFunc( indices[ i ], tLeaf ) )
+			{
+				return true;
+			}
+		}
+		return false;
+	} );
+}
+
+
+template<typename T>
+template<uint32_t N, typename LeafFunc>
+void BVH<T>::TraversePacketLeaves( const rayPacket_t<N, T>& packet, const T* tMax, LeafFunc&& leafFunc ) const
+{
+	if ( nodes.empty() )
+	{
+		return;
+	}
+
+	struct stackEntry_t
+	{
+		uint32_t	nodeIx;
+		T		tEntry;
+	};
+
+	stackEntry_t stack[ BvhMaxDepth ];
+	uint32_t stackSize = 0;
+
+	T tRoot;
+	if ( !IntersectPacketAABB<N, T>( packet, nodes[ 0 ].boundsMin, nodes[ 0 ].boundsMax, tMax, tRoot ) )
+	{
+		return;
+	}
+	stack[ stackSize++ ] = { 0, tRoot };
+
+	while ( stackSize > 0 )
+	{
+		const stackEntry_t entry = stack[ --stackSize ];
+
+		T tFarthest = tMax[ 0 ];
+		for ( uint32_t lane = 1; lane < N; ++lane )
+		{
+			tFarthest = ( tMax[ lane ] > tFarthest ) ? tMax[ lane ] : tFarthest;
+		}
+
+		if ( entry.tEntry > tFarthest )
+		{
+			continue;
+		}
+
+		const bvhNode_t<T>& node = nodes[ entry.nodeIx ];
+		if ( node.count > 0 )
+		{
+			leafFunc( entry.nodeIx );
+			continue;
+		}
+
+		const uint32_t leftIx = node.offset;
+		const uint32_t rightIx = node.offset + 1;
+
+		T tLeft = std::numeric_limits<T>::max();
+		T tRight = std::numeric_limits<T>::max();
+		const bool hitLeft = IntersectPacketAABB<N, T>( packet, nodes[ leftIx ].boundsMin, nodes[ leftIx ].boundsMax, tMax, tLeft );
+		const bool hitRight = IntersectPacketAABB<N, T>( packet, nodes[ rightIx ].boundsMin, nodes[ rightIx ].boundsMax, tMax, tRight );
+
+		if ( hitLeft && hitRight )
+		{
+			if ( tLeft <= tRight )
+			{
+				stack[ stackSize++ ] = { rightIx, tRight };
+				stack[ stackSize++ ] = { leftIx, tLeft };
+			}
+			else
+			{
+				stack[ stackSize++ ] = { leftIx, tLeft };
+				stack[ stackSize++ ] = { rightIx, tRight };
+			}
+		}
+		else if ( hitLeft )
+		{
+			stack[ stackSize++ ] = { leftIx, tLeft };
+		}
+		else if ( hitRight )
+		{
+			stack[ stackSize++ ] = { rightIx, tRight };
+		}
+	}
+}
+
+
+template<typename T>
+template<uint32_t N, typename PrimFunc>
+void BVH<T>::TraversePacket( const rayPacket_t<N, T>& packet, const T* tMax, PrimFunc&& primFunc ) const
+{
+	TraversePacketLeaves<N>( packet, tMax, [&]( const uint32_t nodeIx )
+	{
+		const bvhNode_t<T>& node = nodes[ nodeIx ];
+		const uint32_t last = node.offset + node.count;
+		for ( uint32_t i = node.offset; i < last; ++i )
+		{
+			primFunc( indices[ i ] );
+		}
+	} );
+}
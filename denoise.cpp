@@ -0,0 +1,162 @@
+#include "denoise.h"
+#include <cmath>
+#include <algorithm>
+
+static const float AlbedoEpsilon = 1e-3f;	// Keeps demodulation finite on black surfaces
+static const float DepthEpsilon = 1e-6f;
+
+
+void denoiseBuffer_t::Resize( const uint32_t bufferWidth, const uint32_t bufferHeight )
+{
+	width = bufferWidth;
+	height = bufferHeight;
+
+	const size_t pixelCnt = static_cast<size_t>( width ) * height;
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		color[ i ].assign( pixelCnt, 0.0f );
+		albedo[ i ].assign( pixelCnt, 0.0f );
+		normal[ i ].assign( pixelCnt, 0.0f );
+	}
+	depth.assign( pixelCnt, 0.0f );
+	surface.assign( pixelCnt, 0 );
+}
+
+
+// One 5x5 a-trous pass with taps step pixels apart
+static void FilterRow( const denoiseBuffer_t& buffer, const denoisePlane_t src[ 3 ], denoisePlane_t dst[ 3 ], const uint32_t y, const int32_t step, const float invColorVar )
+{
+	static const float Kernel[ 3 ] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f }; // B3 spline by |offset|
+
+	const int32_t width = static_cast<int32_t>( buffer.width );
+	const int32_t height = static_cast<int32_t>( buffer.height );
+
+	for ( int32_t x = 0; x < width; ++x )
+	{
+		const size_t p = static_cast<size_t>( y ) * width + x;
+		if ( !buffer.surface[ p ] )
+		{
+			for ( int32_t c = 0; c < 3; ++c )
+			{
+				dst[ c ][ p ] = src[ c ][ p ];
+			}
+			continue;
+		}
+
+		const float depthScale = 1.0f / ( DenoiseSigmaDepth * step * std::max( buffer.depth[ p ], DepthEpsilon ) );
+
+		float sum[ 3 ] = { 0.0f, 0.0f, 0.0f };
+		float weightSum = 0.0f;
+		for ( int32_t dy = -2; dy <= 2; ++dy )
+		{
+			const int32_t qy = static_cast<int32_t>( y ) + dy * step;
+			if ( ( qy < 0 ) || ( qy >= height ) )
+			{
+				continue;
+			}
+
+			for ( int32_t dx = -2; dx <= 2; ++dx )
+			{
+				const int32_t qx = x + dx * step;
+				if ( ( qx < 0 ) || ( qx >= width ) )
+				{
+					continue;
+				}
+
+				const size_t q = static_cast<size_t>( qy ) * width + qx;
+				if ( !buffer.surface[ q ] )
+				{
+					continue;
+				}
+
+				const float normalDot = buffer.normal[ 0 ][ p ] * buffer.normal[ 0 ][ q ] + buffer.normal[ 1 ][ p ] * buffer.normal[ 1 ][ q ] + buffer.normal[ 2 ][ p ] * buffer.normal[ 2 ][ q ];
+				if ( normalDot <= 0.0f )
+				{
+					continue;
+				}
+
+				float colorDist = 0.0f;
+				for ( int32_t c = 0; c < 3; ++c )
+				{
+					const float d = src[ c ][ p ] - src[ c ][ q ];
+					colorDist += d * d;
+				}
+
+				const float depthDist = std::fabs( buffer.depth[ p ] - buffer.depth[ q ] ) * depthScale;
+				const float w = Kernel[ std::abs( dx ) ] * Kernel[ std::abs( dy ) ] * std::pow( normalDot, DenoiseNormalPower ) * std::exp( -depthDist - colorDist * invColorVar );
+
+				for ( int32_t c = 0; c < 3; ++c )
+				{
+					sum[ c ] += w * src[ c ][ q ];
+				}
+				weightSum += w;
+			}
+		}
+
+		// The center tap always contributes, so weightSum > 0
+		const float invWeight = 1.0f / weightSum;
+		for ( int32_t c = 0; c < 3; ++c )
+		{
+			dst[ c ][ p ] = sum[ c ] * invWeight;
+		}
+	}
+}
+
+
+void Denoise( denoiseBuffer_t& buffer, ThreadPool& pool )
+{
+	const size_t pixelCnt = static_cast<size_t>( buffer.width ) * buffer.height;
+
+	// Filtering irradiance instead of radiance keeps texture detail out of the blur
+	denoisePlane_t irradiance[ 2 ][ 3 ];
+	for ( int32_t c = 0; c < 3; ++c )
+	{
+		irradiance[ 0 ][ c ].resize( pixelCnt );
+		irradiance[ 1 ][ c ].resize( pixelCnt );
+	}
+
+	pool.ParallelFor( buffer.height, [&]( const uint32_t y, const uint32_t workerIx )
+	{
+		const size_t rowEnd = static_cast<size_t>( y + 1 ) * buffer.width;
+		for ( size_t p = static_cast<size_t>( y ) * buffer.width; p < rowEnd; ++p )
+		{
+			for ( int32_t c = 0; c < 3; ++c )
+			{
+				irradiance[ 0 ][ c ][ p ] = buffer.color[ c ][ p ] / std::max( buffer.albedo[ c ][ p ], AlbedoEpsilon );
+			}
+		}
+	} );
+
+	float sigmaColor = DenoiseSigmaColor;
+	for ( uint32_t pass = 0; pass < DenoisePassCnt; ++pass )
+	{
+		const denoisePlane_t* src = irradiance[ pass & 1 ];
+		denoisePlane_t* dst = irradiance[ ( pass + 1 ) & 1 ];
+		const int32_t step = 1 << pass;
+		const float invColorVar = 1.0f / ( sigmaColor * sigmaColor );
+
+		pool.ParallelFor( buffer.height, [&]( const uint32_t y, const uint32_t workerIx )
+		{
+			FilterRow( buffer, src, dst, y, step, invColorVar );
+		} );
+
+		sigmaColor *= 0.5f;
+	}
+
+	const denoisePlane_t* result = irradiance[ DenoisePassCnt & 1 ];
+	pool.ParallelFor( buffer.height, [&]( const uint32_t y, const uint32_t workerIx )
+	{
+		const size_t rowEnd = static_cast<size_t>( y + 1 ) * buffer.width;
+		for ( size_t p = static_cast<size_t>( y ) * buffer.width; p < rowEnd; ++p )
+		{
+			if ( !buffer.surface[ p ] )
+			{
+				continue;
+			}
+			for ( int32_t c = 0; c < 3; ++c )
+			{
+				buffer.color[ c ][ p ] = result[ c ][ p ] * std::max( buffer.albedo[ c ][ p ], AlbedoEpsilon );
+			}
+		}
+	} );
+}
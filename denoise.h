@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "alignedAllocator.h"
+#include "threadPool.h"
+
+static const uint32_t	DenoisePassCnt		= 5;		// Pass i reads taps 2^i pixels apart
+static const float		DenoiseSigmaColor	= 0.5f;		// Irradiance difference, halved every pass
+static const float		DenoiseSigmaDepth	= 0.02f;	// Depth difference relative to the center depth, per tap step
+static const float		DenoiseNormalPower	= 64.0f;
+
+typedef std::vector<float, AlignedAllocator<float>> denoisePlane_t;
+
+// Filter input and output, one plane per channel. Pixels without a surface are passed through
+// untouched and are never used as taps.
+struct denoiseBuffer_t
+{
+	uint32_t				width;
+	uint32_t				height;
+	denoisePlane_t			color[ 3 ];		// Linear radiance, replaced by the filtered result
+	denoisePlane_t			albedo[ 3 ];
+	denoisePlane_t			normal[ 3 ];
+	denoisePlane_t			depth;
+	std::vector<uint8_t>	surface;
+
+	void Resize( const uint32_t bufferWidth, const uint32_t bufferHeight );
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) on albedo-demodulated color,
+// one row per thread pool task
+void Denoise( denoiseBuffer_t& buffer, ThreadPool& pool );
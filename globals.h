@@ -6,18 +6,26 @@
 #include "../GfxCore/color.h"
 #include "../GfxCore/image.h"
 #include "debug.h"
+#include "sampler.h"
 
 #define USE_AABB		1
 #define USE_RELFECTION	1
 #define USE_SHADOWS		1
 #define USE_RAYTRACE	1
-#define USE_SSRAND		0 // TODO: Halton sequence
+#define USE_PACKETS		1 // Coherent primary rays in SIMD-width packets
+#define USE_FLOAT_TRACE	0 // Single-precision acceleration structures and intersection kernels
+#define USE_WAVEFRONT	0 // Trace in queue-based stages instead of recursing per pixel
+#define USE_SSRAND		0 // Sub-pixel offsets drawn from PixelSampler
 #define USE_SS4X		0
+#define USE_ADAPTIVE	0 // Extra subsamples only where the pixel estimate is still noisy
+#define USE_PROGRESSIVE	0 // Refine in passes until ProgressiveBudgetMs runs out
+#define USE_DENOISE		0 // Edge-avoiding filter over the traced image, guided by normal, depth and albedo
 #define USE_RASTERIZE	1
+#define USE_DEPTH_PREPASS	1 // Rasterizer resolves visibility first, then shades each pixel once
 #define DRAW_WIREFRAME	1
 #define	DRAW_AABB		1
 #define PHONG_NORMALS	1
-// TODO: winding order support
+#define USE_BACKFACE_CULL	0 // Rasterizer skips triangles facing away from the camera, by each model's winding order. Off until every model's winding is verified
 
 #if 0
 static const uint32_t	RenderWidth			= 1920;
@@ -43,6 +51,16 @@ static const float		AmbientLight		= 0.1f;
 static const double		SpecularPower		= 15.0;
 static const double		MaxT				= 1000.0;
 static const uint32_t	MaxBounces			= 3;
+static const uint32_t	TileSize			= 16;	// Pixels per side of a trace scheduling tile
+static const samplerType_t	PixelSampler	= SAMPLER_SOBOL;
+static const uint32_t	AdaptiveMinSamples	= 4;	// Subsamples taken before a pixel's variance is trusted
+static const uint32_t	AdaptiveMaxSamples	= 64;
+static const double		AdaptiveMaxError	= 0.004;	// Standard error of mean linear luminance, about 1/255
+static const double		ProgressiveBudgetMs	= 250.0;
+static const uint32_t	ProgressiveMaxSamples	= 256;
+static const uint32_t	ProgressivePreviewStride	= 4;	// Pixels per side of a first-pass sample
+static const uint32_t	ExhaustiveLightCnt	= 8;	// Scenes with at most this many lights shade every light
+static const uint32_t	LightSampleCnt		= 4;	// Shadow rays per shading point once lights are sampled
 
 enum axisMode_t : uint32_t
 {
@@ -62,6 +80,53 @@ enum hitCode_t : uint32_t
 };
 
 
+// Ray traced outputs besides color
+enum aovChannel_t : uint32_t
+{
+	AOV_FACING		= ( 1 << 0 ),	// Eye-to-surface cosine
+	AOV_NORMAL		= ( 1 << 1 ),
+	AOV_ALBEDO		= ( 1 << 2 ),
+	AOV_DEPTH		= ( 1 << 3 ),
+	AOV_INSTANCE	= ( 1 << 4 ),
+	AOV_MATERIAL	= ( 1 << 5 ),
+	AOV_HITCOUNT	= ( 1 << 6 ),	// Surface hits along the pixel's paths, primary and reflected
+	AOV_MOTION		= ( 1 << 7 ),	// Screen-space motion of the primary hit since the previous frame
+	AOV_ALL			= 0xFF,
+};
+
+// Selected AOVs. Channels left out are never accumulated, resolved or allocated, and their
+// per-pixel fields compile out.
+#define USE_AOV_FACING		1
+#define USE_AOV_NORMAL		1
+#define USE_AOV_ALBEDO		0
+#define USE_AOV_DEPTH		0
+#define USE_AOV_INSTANCE	0
+#define USE_AOV_MATERIAL	0
+#define USE_AOV_HITCOUNT	0
+#define USE_AOV_MOTION		0
+
+// Channels gathered while tracing: the selected AOVs plus the denoiser's guides
+#define TRACE_AOV_FACING	USE_AOV_FACING
+#define TRACE_AOV_NORMAL	( USE_AOV_NORMAL || USE_DENOISE )
+#define TRACE_AOV_ALBEDO	( USE_AOV_ALBEDO || USE_DENOISE )
+#define TRACE_AOV_DEPTH		( USE_AOV_DEPTH || USE_DENOISE )
+#define TRACE_AOV_INSTANCE	USE_AOV_INSTANCE
+#define TRACE_AOV_MATERIAL	USE_AOV_MATERIAL
+#define TRACE_AOV_HITCOUNT	USE_AOV_HITCOUNT
+#define TRACE_AOV_MOTION	USE_AOV_MOTION
+#define TRACE_AOV_SURFACE	( TRACE_AOV_DEPTH || TRACE_AOV_INSTANCE || TRACE_AOV_MATERIAL || TRACE_AOV_HITCOUNT || TRACE_AOV_MOTION ) // Needs per-pixel surface hits
+
+static const uint32_t	AovChannels			=	( USE_AOV_FACING ? AOV_FACING : 0 ) | ( USE_AOV_NORMAL ? AOV_NORMAL : 0 ) |
+												( USE_AOV_ALBEDO ? AOV_ALBEDO : 0 ) | ( USE_AOV_DEPTH ? AOV_DEPTH : 0 ) |
+												( USE_AOV_INSTANCE ? AOV_INSTANCE : 0 ) | ( USE_AOV_MATERIAL ? AOV_MATERIAL : 0 ) |
+												( USE_AOV_HITCOUNT ? AOV_HITCOUNT : 0 ) | ( USE_AOV_MOTION ? AOV_MOTION : 0 );
+
+static const uint32_t	TraceChannels		=	( TRACE_AOV_FACING ? AOV_FACING : 0 ) | ( TRACE_AOV_NORMAL ? AOV_NORMAL : 0 ) |
+												( TRACE_AOV_ALBEDO ? AOV_ALBEDO : 0 ) | ( TRACE_AOV_DEPTH ? AOV_DEPTH : 0 ) |
+												( TRACE_AOV_INSTANCE ? AOV_INSTANCE : 0 ) | ( TRACE_AOV_MATERIAL ? AOV_MATERIAL : 0 ) |
+												( TRACE_AOV_HITCOUNT ? AOV_HITCOUNT : 0 ) | ( TRACE_AOV_MOTION ? AOV_MOTION : 0 );
+
+
 struct sample_t
 {
 	Color		color;
@@ -71,6 +136,8 @@ struct sample_t
 	double		t;
 	double		surfaceDot;
 	uint32_t	modelIx;
+	uint32_t	instanceIx;
+	uint32_t	hitCnt;
 	hitCode_t	hitCode;
 	int32_t		materialId;
 };
@@ -80,6 +147,11 @@ struct debug_t
 {
 	Image<Color> diffuse;
 	Image<Color> normal;
+	Image<Color> albedo;
+	Image<Color> instanceId;
+	Image<Color> materialId;
+	Image<Color> hitCount;
+	Image<Color> motion;
 	Image<Color> wireframe;
 	Image<Color> topWire;
 	Image<Color> sideWire;
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <float.h>
+#include <limits>
+#include "../GfxCore/mathVector.h"
+#include "../GfxCore/matrix.h"
+#include "../GfxCore/geom.h"
+#include "globals.h"
+
+// Scalar type of the acceleration structures and intersection kernels. Shading stays in double.
+#if USE_FLOAT_TRACE
+typedef float	real_t;
+#else
+typedef double	real_t;
+#endif
+
+// Per-precision tolerances. HitT is in units of the ray direction, Origin is relative to the magnitude of the point.
+template<typename T> struct traceEpsilon_t;
+
+template<> struct traceEpsilon_t<double>
+{
+	static constexpr double HitT = 1e-7;
+	static constexpr double Barycentric = 0.0;
+	static constexpr double Origin = 0.0;
+	static constexpr double SlabScale = 1.0 + 3.0 * DBL_EPSILON;	// Covers rounding of the slab distances
+};
+
+// Single precision can't rely on backface culling and a tiny hit distance alone:
+// barycentrics are widened so shared edges overlap instead of leaking rays through,
+// and secondary ray origins are pushed off the surface relative to their magnitude.
+template<> struct traceEpsilon_t<float>
+{
+	static constexpr float HitT = 1e-5f;
+	static constexpr float Barycentric = 1e-6f;
+	static constexpr float Origin = 1e-5f;
+	static constexpr float SlabScale = 1.0f + 3.0f * FLT_EPSILON;
+};
+
+template<typename T>
+struct traceRay_t
+{
+	T			o[ 3 ];
+	T			d[ 3 ];
+	T			invD[ 3 ];
+};
+
+
+// Minimal record of the closest hit. Shading attributes are built from it once traversal is done.
+template<typename T>
+struct hit_t
+{
+	T			t;
+	T			u;		// Barycentric weight of v1
+	T			v;		// Barycentric weight of v2
+	uint32_t	triIx;
+	uint32_t	instanceIx;
+};
+
+
+template<typename T>
+inline traceRay_t<T> MakeTraceRay( const vec3d& o, const vec3d& d )
+{
+	traceRay_t<T> tRay;
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		tRay.o[ i ] = static_cast<T>( o[ i ] );
+		tRay.d[ i ] = static_cast<T>( d[ i ] );
+		tRay.invD[ i ] = ( tRay.d[ i ] != T( 0 ) ) ? ( T( 1 ) / tRay.d[ i ] ) : std::numeric_limits<T>::max();
+	}
+
+	return tRay;
+}
+
+
+template<typename T>
+inline traceRay_t<T> MakeTraceRay( const Ray& ray )
+{
+	return MakeTraceRay<T>( ray.o, ray.GetVector() );
+}
+
+
+// Moves a ray into another space. The direction is not renormalized, so t is unchanged
+// and hit distances from different instances stay comparable.
+template<typename T>
+inline traceRay_t<T> TransformTraceRay( const mat4x4d& m, const traceRay_t<T>& ray )
+{
+	const vec4d o = m * vec4d( ray.o[ 0 ], ray.o[ 1 ], ray.o[ 2 ], 1.0 );
+	const vec4d d = m * vec4d( ray.d[ 0 ], ray.d[ 1 ], ray.d[ 2 ], 0.0 );
+	return MakeTraceRay<T>( Trunc<4, 1>( o ), Trunc<4, 1>( d ) );
+}
+
+
+// Moves a secondary ray origin off the surface it leaves, to the side the ray travels toward
+template<typename T>
+inline vec3d OffsetRayOrigin( const vec3d& pt, const vec3d& n, const vec3d& dir )
+{
+	if ( traceEpsilon_t<T>::Origin == T( 0 ) )
+	{
+		return pt;
+	}
+
+	const double magnitude = std::max( 1.0, std::max( fabs( pt[ 0 ] ), std::max( fabs( pt[ 1 ] ), fabs( pt[ 2 ] ) ) ) );
+	const double offset = magnitude * traceEpsilon_t<T>::Origin;
+	return ( Dot( n, dir ) >= 0.0 ) ? ( pt + offset * n ) : ( pt - offset * n );
+}
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <numeric>
+#include <float.h>
+#include "lightTree.h"
+
+struct lightBuildContext_t
+{
+	const std::vector<vec3d>*	positions;
+	const std::vector<double>*	powers;
+	std::vector<uint32_t>		order;
+};
+
+
+static void BuildRecursive( lightBuildContext_t& ctx, LightTree& tree, const uint32_t nodeIx, const uint32_t first, const uint32_t count )
+{
+	const std::vector<vec3d>& positions = *ctx.positions;
+	const uint32_t last = first + count;
+
+	AABB bounds;
+	double power = 0.0;
+	for ( uint32_t i = first; i < last; ++i )
+	{
+		bounds.Expand( positions[ ctx.order[ i ] ] );
+		power += ( *ctx.powers )[ ctx.order[ i ] ];
+	}
+
+	lightNode_t& node = tree.nodes[ nodeIx ];
+	node.power = power;
+
+	if ( count == 1 )
+	{
+		node.offset = ctx.order[ first ];
+		node.count = 1;
+		return;
+	}
+
+	const vec3d extent = bounds.max - bounds.min;
+	int32_t axis = 0;
+	if ( extent[ 1 ] > extent[ axis ] )
+	{
+		axis = 1;
+	}
+	if ( extent[ 2 ] > extent[ axis ] )
+	{
+		axis = 2;
+	}
+
+	const uint32_t mid = first + count / 2;
+	std::nth_element( ctx.order.begin() + first, ctx.order.begin() + mid, ctx.order.begin() + last, [&]( const uint32_t a, const uint32_t b )
+	{
+		return positions[ a ][ axis ] < positions[ b ][ axis ];
+	} );
+
+	const uint32_t childIx = static_cast<uint32_t>( tree.nodes.size() );
+	tree.nodes.resize( childIx + 2 );
+
+	// Resizing may have moved the node
+	tree.nodes[ nodeIx ].offset = childIx;
+	tree.nodes[ nodeIx ].count = 0;
+
+	BuildRecursive( ctx, tree, childIx, first, mid - first );
+	BuildRecursive( ctx, tree, childIx + 1, mid, last - mid );
+}
+
+
+void LightTree::Build( const std::vector<vec3d>& positions, const std::vector<double>& powers )
+{
+	nodes.clear();
+
+	const uint32_t lightCnt = static_cast<uint32_t>( positions.size() );
+	if ( lightCnt == 0 )
+	{
+		return;
+	}
+
+	lightBuildContext_t ctx;
+	ctx.positions = &positions;
+	ctx.powers = &powers;
+	ctx.order.resize( lightCnt );
+	std::iota( ctx.order.begin(), ctx.order.end(), 0 );
+
+	nodes.reserve( 2 * lightCnt - 1 );
+	nodes.resize( 1 );
+	BuildRecursive( ctx, *this, 0, 0, lightCnt );
+}
+
+
+// ShadeLight has no distance falloff, so a light adds at most its power scaled by the material
+// at any shading point. Weighting by anything that shrinks with distance would give far lights
+// a tiny pmf for their full contribution.
+static double NodeImportance( const lightNode_t& node )
+{
+	return node.power;
+}
+
+
+uint32_t LightTree::Sample( double u, double& pmf ) const
+{
+	pmf = 1.0;
+
+	uint32_t nodeIx = 0;
+	while ( nodes[ nodeIx ].count == 0 )
+	{
+		const uint32_t leftIx = nodes[ nodeIx ].offset;
+		const double left = NodeImportance( nodes[ leftIx ] );
+		const double right = NodeImportance( nodes[ leftIx + 1 ] );
+		const double total = left + right;
+		const double pLeft = ( total > 0.0 ) ? ( left / total ) : 0.5;
+
+		// Reuse u for the next level by rescaling the chosen interval to [0, 1)
+		if ( u < pLeft )
+		{
+			u = u / pLeft;
+			pmf *= pLeft;
+			nodeIx = leftIx;
+		}
+		else
+		{
+			u = ( u - pLeft ) / ( 1.0 - pLeft );
+			pmf *= 1.0 - pLeft;
+			nodeIx = leftIx + 1;
+		}
+		u = std::min( u, 1.0 - DBL_EPSILON );
+	}
+
+	return nodes[ nodeIx ].offset;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "../GfxCore/mathVector.h"
+#include "../GfxCore/geom.h"
+
+// Siblings are stored next to each other, like BVH nodes. Every leaf holds exactly one light.
+struct lightNode_t
+{
+	double		power;		// Sum of the lights below
+	uint32_t	offset;		// Interior: index of first child, second child follows. Leaf: light index
+	uint32_t	count;		// Zero for interior nodes
+};
+
+
+// Light hierarchy for picking one of many point lights in proportion to its power, which bounds
+// what the light contributes at any shading point (Conty Estevez and Kulla, "Importance Sampling
+// of Many Lights", without the distance term since lights here do not fall off).
+class LightTree
+{
+public:
+	// Median split along the longest axis of the light positions
+	void Build( const std::vector<vec3d>& positions, const std::vector<double>& powers );
+
+	// Walks from the root, choosing each child by its power, and returns the light it reaches.
+	// pmf is the probability of that light being returned.
+	uint32_t Sample( double u, double& pmf ) const;
+
+	bool IsEmpty() const
+	{
+		return nodes.empty();
+	}
+
+	std::vector<lightNode_t>	nodes;
+};
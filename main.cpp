@@ -11,6 +11,7 @@
 #include <tuple>
 #include <map>
 #include <thread>
+#include <atomic>
 #include "../GfxCore/bitmap.h"
 #include "../GfxCore/color.h"
 #include "../GfxCore/mathVector.h"
@@ -26,12 +27,20 @@
 #include "debug.h"
 #include "globals.h"
 #include "timer.h"
+#include "bvh.h"
+#include "threadPool.h"
+#include "packet.h"
+#include "simd.h"
+#include "wavefront.h"
+#include "denoise.h"
 
 ResourceManager	rm;
+ThreadPool		threadPool;
 
 matHdl_t		colorMaterialId = 16;
 matHdl_t		diffuseMaterialId = 17;
 matHdl_t		mirrorMaterialId = 18;
+matHdl_t		sphereMaterialId = 19;
 
 Scene			scene;
 SceneView		views[4];
@@ -61,6 +70,8 @@ sample_t RecordSkyInfo( const Ray& r, const double t )
 	sample.normal = vec3d( 0.0 );
 	sample.hitCode = HIT_SKY;
 	sample.modelIx = ResourceManager::InvalidModelIx;
+	sample.instanceIx = ResourceManager::InvalidModelIx;
+	sample.hitCnt = 0;
 	sample.pt = vec3d( 0.0 );
 	sample.surfaceDot = 0.0;
 	sample.t = t;
@@ -70,34 +81,63 @@ sample_t RecordSkyInfo( const Ray& r, const double t )
 }
 
 
-sample_t RecordSurfaceInfo( const Ray& r, const double t, const uint32_t triIndex, const uint32_t modelIx )
+// Primitives are untextured, so albedo is the primitive color
+template<typename T>
+sample_t RecordPrimitiveInfo( const Ray& r, const hit_t<T>& hit )
+{
+	const primitive_t& prim = GetPrimitiveObject( scene, hit.instanceIx );
+
+	sample_t sample;
+
+	sample.pt = r.GetPoint( hit.t );
+	sample.t = hit.t;
+	sample.normal = PrimitiveNormal( prim, sample.pt );
+
+	sample.color = prim.color;
+	sample.albedo = sample.color;
+	sample.materialId = prim.materialId;
+
+	sample.surfaceDot = Dot( r.GetVector(), sample.normal );
+	sample.hitCode = ( sample.surfaceDot > 0.0 ) ? HIT_BACKFACE : HIT_FRONTFACE;
+
+	sample.modelIx = ResourceManager::InvalidModelIx;
+	sample.instanceIx = hit.instanceIx;
+	sample.hitCnt = 1;
+
+	return sample;
+}
+
+
+template<typename T>
+sample_t RecordSurfaceInfo( const Ray& r, const hit_t<T>& hit )
 {
-	const ModelInstance& model = scene.models[ modelIx ];
+	if ( IsPrimitiveObject( scene, hit.instanceIx ) )
+	{
+		return RecordPrimitiveInfo( r, hit );
+	}
+
+	const instance_t& instance = scene.instances[ hit.instanceIx ];
+	const ModelInstance& model = scene.models[ instance.meshIx ];
 	const std::vector<Triangle>& triCache = model.triCache;
-	const Triangle& tri = triCache[ triIndex ];
+	const Triangle& tri = triCache[ hit.triIx ];
 
 	sample_t sample;
 
-	sample.pt = r.GetPoint( t );
-	sample.t = t;
+	sample.pt = r.GetPoint( hit.t );
+	sample.t = hit.t;
 
-	const vec3d b = PointToBarycentric( sample.pt, Trunc<4, 1>( tri.v0.pos ), Trunc<4, 1>( tri.v1.pos ), Trunc<4, 1>( tri.v2.pos ) );
+	const vec3d b = vec3d( 1.0 - hit.u - hit.v, hit.u, hit.v );
 #if PHONG_NORMALS
-	sample.normal = ( b[ 0 ] * tri.v0.normal ) + ( b[ 1 ] * tri.v1.normal ) + ( b[ 2 ] * tri.v2.normal );
-	sample.normal = sample.normal.Normalize();
+	const vec3d objectNormal = ( b[ 0 ] * tri.v0.normal ) + ( b[ 1 ] * tri.v1.normal ) + ( b[ 2 ] * tri.v2.normal );
+	sample.normal = TransformNormal( instance, objectNormal );
 #else
-	sample.normal = tri.n;
+	sample.normal = TransformNormal( instance, tri.n );
 #endif
 
-	vec4d color0 = ColorToVector( tri.v0.color );
-	vec4d color1 = ColorToVector( tri.v1.color );
-	vec4d color2 = ColorToVector( tri.v2.color );
-	vec4d mixedColor = b[ 0 ] * color0 + b[ 1 ] * color1 + b[ 2 ] * color2;
-	sample.color = Vec4dToColor( mixedColor );
-
+	sample.color = instance.color;
 	sample.albedo = sample.color;
 
-	sample.materialId = tri.materialId;
+	sample.materialId = GetInstanceMaterial( instance, tri );
 	
 	const material_t* material = rm.GetMaterialRef( sample.materialId );
 	if( ( material != nullptr ) && material->textured )
@@ -117,68 +157,320 @@ sample_t RecordSurfaceInfo( const Ray& r, const double t, const uint32_t triInde
 		sample.hitCode = HIT_FRONTFACE;
 	}
 
-	sample.modelIx = modelIx;
+	sample.modelIx = instance.meshIx;
+	sample.instanceIx = hit.instanceIx;
+	sample.hitCnt = 1;
 
 	return sample;
 }
 
 
-bool IntersectScene( const Ray& ray, const bool cullBackfaces, const bool stopAtFirstIntersection, sample_t& outSample )
+// Closest hit over both BVH levels. Leaves hit.instanceIx untouched on a miss.
+template<typename T>
+bool TraceClosestHit( const traceRay_t<T>& tRay, const bool cullBackfaces, hit_t<T>& hit )
+{
+	bool found = false;
+
+	// Both levels share hit.t, so a hit in one instance prunes the remaining instances and nodes
+	scene.tlas.Traverse( tRay, hit.t, [&]( const uint32_t instanceIx, T& tClosest ) -> bool
+	{
+		if ( IsPrimitiveObject( scene, instanceIx ) )
+		{
+			if ( IntersectRayPrimitive( tRay, GetPrimitiveObject( scene, instanceIx ), cullBackfaces, tClosest, tClosest ) )
+			{
+				hit.triIx = 0;
+				hit.instanceIx = instanceIx;
+				found = true;
+			}
+			return false;
+		}
+
+		const instance_t& instance = scene.instances[ instanceIx ];
+		const BVH<T>& blas = scene.blas[ instance.meshIx ];
+		const triSoA_t<T>& soa = scene.triSoA[ instance.meshIx ];
+		const traceRay_t<T> objRay = TransformTraceRay( instance.invTransform, tRay );
+
+		return blas.TraverseLeaves( objRay, tClosest, [&]( const uint32_t nodeIx, T& tLeaf ) -> bool
+		{
+			const uint32_t firstBlock = soa.leafFirstBlock[ nodeIx ];
+			const uint32_t lastBlock = firstBlock + LeafBlockCount( blas.nodes[ nodeIx ] );
+			for ( uint32_t blockIx = firstBlock; blockIx < lastBlock; ++blockIx )
+			{
+				const triBlock_t<T>& block = soa.blocks[ blockIx ];
+				const uint32_t lane = ClosestHitTriBlock( objRay, block, cullBackfaces, tLeaf, hit.u, hit.v );
+				if ( lane < TriBlockWidth )
+				{
+					hit.triIx = block.triIx[ lane ];
+					hit.instanceIx = instanceIx;
+					found = true;
+				}
+			}
+			return false;
+		} );
+	} );
+
+	return found;
+}
+
+
+template<typename T>
+bool IntersectScene( const Ray& ray, const bool cullBackfaces, sample_t& outSample )
 {
 	outSample.t = DBL_MAX;
 	outSample.hitCode = HIT_NONE;
 
-	int hitCnt = 0;
+	hit_t<T> hit;
+	hit.t = std::numeric_limits<T>::max();
+	hit.instanceIx = ResourceManager::InvalidModelIx;
 
-	const uint32_t modelCnt = scene.models.size();
-	for ( uint32_t modelIx = 0; modelIx < modelCnt; ++modelIx )
+	if ( !TraceClosestHit( MakeTraceRay<T>( ray ), cullBackfaces, hit ) )
 	{
-		const ModelInstance& model = scene.models[ modelIx ];
+		return false;
+	}
+
+	outSample = RecordSurfaceInfo( ray, hit );
+	return true;
+}
 
-#if USE_AABB
-		double t0 = 0.0;
-		double t1 = 0.0;
-		if ( !model.octree.GetAABB().Intersect( ray, t0, t1 ) )
-		{
-			continue;
-		}
-#endif
 
-		const std::vector<Triangle>& triCache = model.triCache;
-		std::vector<uint32_t> triIndices;
-		model.octree.Intersect( ray, triIndices );
+struct occluder_t
+{
+	uint32_t	instanceIx;
+	uint32_t	blockIx;
+};
+
+
+// Any-hit query along the shadow ray segment. Ray( surface, light ) spans t = [0, 1].
+template<typename T>
+bool OccludedScene( const Ray& shadowRay, const uint32_t lightIx )
+{
+	// Coherent shadow rays tend to be blocked by the same triangles, so try the last blocker first
+	static thread_local std::vector<occluder_t> lastOccluder;
+	if ( lastOccluder.size() <= lightIx )
+	{
+		lastOccluder.resize( scene.lights.size(), { ResourceManager::InvalidModelIx, 0 } );
+	}
+
+	const traceRay_t<T> tRay = MakeTraceRay<T>( shadowRay );
+	const T tLight = T( 1 );
 
-		//const size_t triCnt = triCache.size();
-		const size_t triCnt = triIndices.size();
-		for ( size_t ix = 0; ix < triCnt; ++ix )
+	T t[ TriBlockWidth ];
+	T u[ TriBlockWidth ];
+	T v[ TriBlockWidth ];
+
+	occluder_t& cached = lastOccluder[ lightIx ];
+	if ( ( cached.instanceIx != ResourceManager::InvalidModelIx ) && IsPrimitiveObject( scene, cached.instanceIx ) )
+	{
+		T tPrim;
+		if ( IntersectRayPrimitive( tRay, GetPrimitiveObject( scene, cached.instanceIx ), true, tLight, tPrim ) )
+		{
+			return true;
+		}
+	}
+	else if ( cached.instanceIx != ResourceManager::InvalidModelIx )
+	{
+		const instance_t& instance = scene.instances[ cached.instanceIx ];
+		const triBlock_t<T>& block = scene.triSoA[ instance.meshIx ].blocks[ cached.blockIx ];
+		if ( IntersectRayTriBlock( TransformTraceRay( instance.invTransform, tRay ), block, true, tLight, t, u, v ) != 0 )
 		{
-			const uint32_t triIx = triIndices[ ix ];
-			// const uint32_t triIx = ix;
-			const Triangle& tri = triCache[ triIx ];
+			return true;
+		}
+	}
 
-			double t;
-			bool isBackface;
-			if( RayToTriangleIntersection( ray, tri, isBackface, t ) )
+	T tMax = tLight;
+	const bool occluded = scene.tlas.Traverse( tRay, tMax, [&]( const uint32_t instanceIx, T& tInstance ) -> bool
+	{
+		if ( IsPrimitiveObject( scene, instanceIx ) )
+		{
+			T tPrim;
+			if ( IntersectRayPrimitive( tRay, GetPrimitiveObject( scene, instanceIx ), true, tInstance, tPrim ) )
 			{
-				if ( t > outSample.t )
-					continue;
+				cached.instanceIx = instanceIx;
+				cached.blockIx = 0;
+				return true;
+			}
+			return false;
+		}
 
-				if ( cullBackfaces && isBackface )
-					continue;
-					
-				outSample = RecordSurfaceInfo( ray, t, triIx, modelIx );
+		const instance_t& instance = scene.instances[ instanceIx ];
+		const BVH<T>& blas = scene.blas[ instance.meshIx ];
+		const triSoA_t<T>& soa = scene.triSoA[ instance.meshIx ];
+		const traceRay_t<T> objRay = TransformTraceRay( instance.invTransform, tRay );
 
-				if ( stopAtFirstIntersection )
+		return blas.TraverseLeaves( objRay, tInstance, [&]( const uint32_t nodeIx, T& tLeaf ) -> bool
+		{
+			const uint32_t firstBlock = soa.leafFirstBlock[ nodeIx ];
+			const uint32_t lastBlock = firstBlock + LeafBlockCount( blas.nodes[ nodeIx ] );
+			for ( uint32_t blockIx = firstBlock; blockIx < lastBlock; ++blockIx )
+			{
+				if ( IntersectRayTriBlock( objRay, soa.blocks[ blockIx ], true, tLeaf, t, u, v ) != 0 )
+				{
+					cached.instanceIx = instanceIx;
+					cached.blockIx = blockIx;
 					return true;
+				}
 			}
+			return false;
+		} );
+	} );
+
+	return occluded;
+}
+
+
+template<typename T>
+sample_t RayTrace_r( const Ray& ray, const sampler_t& sampler, const uint32_t rayDepth );
+
+
+template<typename T>
+Ray MakeShadowRay( const sample_t& surfaceSample, const light_t& light )
+{
+	return Ray( OffsetRayOrigin<T>( surfaceSample.pt, surfaceSample.normal, light.pos - surfaceSample.pt ), light.pos );
+}
+
+
+// Diffuse and specular response to one light, assuming it is visible
+Color ShadeLight( const sample_t& surfaceSample, const material_t& material, const Color& surfaceColor, const vec3d& viewVector, const light_t& light, const Ray& shadowRay )
+{
+	Color shadingColor = Color::Black;
+
+	const vec4d intensity = vec4d( light.intensity, 1.0f );
+
+	vec3d lightDir = shadowRay.GetVector();
+	lightDir = lightDir.Normalize();
+
+	const vec3d halfVector = ( viewVector + lightDir ).Normalize();
+
+	const vec4d D = ColorToVector( Color( material.Kd ) );
+	const vec4d S = ColorToVector( Color( material.Ks ) );
+
+	const vec4d diffuseIntensity = Multiply( D, intensity ) * std::max( 0.0, Dot( lightDir, surfaceSample.normal ) );
+
+	const vec4d specularIntensity = Multiply( S, intensity ) * pow( std::max( 0.0, Dot( surfaceSample.normal, halfVector ) ), material.Ns );
+	
+	shadingColor += Vec4dToColor( specularIntensity );
+	shadingColor += Vec4dToColor( Multiply( diffuseIntensity, ColorToVector( surfaceColor ) ) );
+
+	return shadingColor;
+}
+
+
+struct lightSample_t
+{
+	uint32_t	lightIx;
+	float		weight;		// Scale on the light's contribution that keeps the sum unbiased
+};
+
+static const uint32_t MaxShadedLights = ( ExhaustiveLightCnt > LightSampleCnt ) ? ExhaustiveLightCnt : LightSampleCnt;
+
+
+// Number of lights SelectLights returns for every shading point in the scene
+uint32_t ShadedLightCount()
+{
+	const uint32_t lightCnt = static_cast<uint32_t>( scene.lights.size() );
+	return ( lightCnt <= ExhaustiveLightCnt ) ? lightCnt : LightSampleCnt;
+}
+
+
+// Small light sets are shaded exhaustively at full weight. Larger ones draw LightSampleCnt lights
+// from the light tree, each weighted by 1 / ( LightSampleCnt * pmf ). A point that shades lights
+// ends its path, so the draws use the dimensions its bounce would have taken.
+uint32_t SelectLights( const sampler_t& sampler, const uint32_t rayDepth, lightSample_t selected[ MaxShadedLights ] )
+{
+	const uint32_t lightCnt = static_cast<uint32_t>( scene.lights.size() );
+	if ( lightCnt <= ExhaustiveLightCnt )
+	{
+		for ( uint32_t li = 0; li < lightCnt; ++li )
+		{
+			selected[ li ] = { li, 1.0f };
+		}
+		return lightCnt;
+	}
+
+	for ( uint32_t i = 0; i < LightSampleCnt; ++i )
+	{
+		double pmf;
+		const uint32_t lightIx = scene.lightTree.Sample( Sample1D( sampler, BounceDimension( rayDepth ) + i ), pmf );
+		selected[ i ] = { lightIx, static_cast<float>( 1.0 / ( LightSampleCnt * pmf ) ) };
+	}
+	return LightSampleCnt;
+}
+
+
+template<typename T>
+Ray MakeReflectionRay( const Ray& ray, const sample_t& surfaceSample, const sampler_t& sampler, const uint32_t rayDepth )
+{
+	const vec3d viewVector = ray.GetVector().Reverse().Normalize();
+
+	vec3d reflectVector = ReflectVec3d( surfaceSample.normal, viewVector );
+	reflectVector += SampleCube( sampler, BounceDimension( rayDepth ), 0.1 );
+	reflectVector = MaxT * reflectVector;
+
+	const vec3d reflectOrigin = OffsetRayOrigin<T>( surfaceSample.pt, surfaceSample.normal, reflectVector );
+	return Ray( reflectOrigin, reflectOrigin + reflectVector );
+}
+
+
+template<typename T>
+sample_t ShadeSurface( const Ray& ray, const sample_t& surfaceSample, const sampler_t& sampler, const uint32_t rayDepth )
+{
+	sample_t sample;
+	Color finalColor = Color::Black;
+	const material_t& material = *rm.GetMaterialRef( surfaceSample.materialId );
+	Color surfaceColor = material.textured ? surfaceSample.albedo : surfaceSample.color;		
+
+	vec3d viewVector = ray.GetVector().Reverse();
+	viewVector = viewVector.Normalize();
+
+	Color relfectionColor = Color::Black;
+#if USE_RELFECTION
+	if ( ( rayDepth < MaxBounces ) && ( material.Tr > 0.0 ) )
+	{
+		const Ray reflectionRay = MakeReflectionRay<T>( ray, surfaceSample, sampler, rayDepth );
+
+		const sample_t reflectSample = RayTrace_r<T>( reflectionRay, sampler, rayDepth + 1 );
+		relfectionColor = material.Tr * reflectSample.color;
+
+		sample = surfaceSample;
+		sample.color = relfectionColor;
+		sample.hitCnt += reflectSample.hitCnt;
+
+		return sample;
+	}
+#endif
+
+	lightSample_t selected[ MaxShadedLights ];
+	const uint32_t selectedCnt = SelectLights( sampler, rayDepth, selected );
+	for ( uint32_t si = 0; si < selectedCnt; ++si )
+	{
+		const light_t& L = scene.lights[ selected[ si ].lightIx ];
+		const Ray shadowRay = MakeShadowRay<T>( surfaceSample, L );
+
+#if USE_SHADOWS
+		const bool lightOccluded = OccludedScene<T>( shadowRay, selected[ si ].lightIx );
+#else
+		const bool lightOccluded = false;
+#endif
+
+		Color shadingColor = Color::Black;
+		if ( !lightOccluded )
+		{
+			shadingColor = selected[ si ].weight * ShadeLight( surfaceSample, material, surfaceColor, viewVector, L, shadowRay );
 		}
+
+		finalColor += shadingColor + relfectionColor;
 	}
 
-	return outSample.hitCode != HIT_NONE;
+	const Color ambient = AmbientLight * ( Color( material.Ka ) * surfaceColor );
+
+	sample = surfaceSample;
+	sample.color = finalColor + ambient;
+	return sample;
 }
 
 
-sample_t RayTrace_r( const Ray& ray, const uint32_t rayDepth )
+template<typename T>
+sample_t RayTrace_r( const Ray& ray, const sampler_t& sampler, const uint32_t rayDepth )
 {
 	double tnear = 0;
 	double tfar = 0;
@@ -195,99 +487,103 @@ sample_t RayTrace_r( const Ray& ray, const uint32_t rayDepth )
 #endif
 	 
 	sample_t surfaceSample;	
-	if( !IntersectScene( ray, true, false, surfaceSample ) )
+	if( !IntersectScene<T>( ray, true, surfaceSample ) )
 	{
 		sample = RecordSkyInfo( ray, surfaceSample.t );
 		return sample;
 	}
-	else
-	{
-		Color finalColor = Color::Black;
-		const material_t& material = *rm.GetMaterialRef( surfaceSample.materialId );
-		Color surfaceColor = material.textured ? surfaceSample.albedo : surfaceSample.color;		
-
-		vec3d viewVector = ray.GetVector().Reverse();
-		viewVector = viewVector.Normalize();
-
-		Color relfectionColor = Color::Black;
-#if USE_RELFECTION
-		if ( ( rayDepth < MaxBounces ) && ( material.Tr > 0.0 ) )
-		{
-			vec3d reflectVector = ReflectVec3d( surfaceSample.normal, viewVector );
-			reflectVector += RandomVec3d( 0.1f );
-			reflectVector = MaxT * reflectVector;
 
-			Ray reflectionRay = Ray( surfaceSample.pt, surfaceSample.pt + reflectVector );
-
-			const sample_t reflectSample = RayTrace_r( reflectionRay, rayDepth + 1 );
-			relfectionColor = material.Tr * reflectSample.color;
+	return ShadeSurface<T>( ray, surfaceSample, sampler, rayDepth );
+}
 
-			sample = surfaceSample;
-			sample.color = relfectionColor;
 
-			return sample;
+template<uint32_t N, typename T>
+void IntersectScenePacket( const rayPacket_t<N, T>& packet, const bool cullBackfaces, packetHit_t<N, T>& hits )
+{
+	scene.tlas.TraversePacket<N>( packet, hits.t, [&]( const uint32_t instanceIx )
+	{
+		if ( IsPrimitiveObject( scene, instanceIx ) )
+		{
+			IntersectPacketPrimitive<N, T>( packet, GetPrimitiveObject( scene, instanceIx ), instanceIx, cullBackfaces, hits );
+			return;
 		}
-#endif
 
-		const size_t lightCnt = scene.lights.size();
-		for ( size_t li = 0; li < lightCnt; ++li )
-		{
-			light_t& L = scene.lights[ li ];
-			vec3d& lightPos = L.pos;
-			
-			Ray shadowRay = Ray( surfaceSample.pt, lightPos );
+		const instance_t& instance = scene.instances[ instanceIx ];
+		const BVH<T>& blas = scene.blas[ instance.meshIx ];
+		const triSoA_t<T>& soa = scene.triSoA[ instance.meshIx ];
 
-			sample_t shadowSample;
-#if USE_SHADOWS
-			const bool lightOccluded = IntersectScene( shadowRay, true, true, shadowSample );
-#else
-			const bool lightOccluded = false;
-#endif
+		rayPacket_t<N, T> objPacket;
+		TransformPacket<N, T>( instance.invTransform, packet, objPacket );
 
-			Color shadingColor = Color::Black;
-			if ( !lightOccluded )
+		blas.template TraversePacketLeaves<N>( objPacket, hits.t, [&]( const uint32_t nodeIx )
+		{
+			const bvhNode_t<T>& leaf = blas.nodes[ nodeIx ];
+			const uint32_t firstBlock = soa.leafFirstBlock[ nodeIx ];
+			for ( uint32_t slot = 0; slot < leaf.count; ++slot )
 			{
-				const vec4d intensity = vec4d( L.intensity, 1.0f );
+				const triBlock_t<T>& block = soa.blocks[ firstBlock + slot / TriBlockWidth ];
+				IntersectPacketTriangle<N, T>( objPacket, block, slot % TriBlockWidth, instanceIx, cullBackfaces, hits );
+			}
+		} );
+	} );
+}
 
-				vec3d lightDir = shadowRay.GetVector();
-				lightDir = lightDir.Normalize();
 
-				const vec3d halfVector = ( viewVector + lightDir ).Normalize();
+SceneView SetupFrontView()
+{
+	SceneView view;
 
-				const vec4d D = ColorToVector( Color( material.Kd ) );
-				const vec4d S = ColorToVector( Color( material.Ks ) );
+	view.targetSize = RenderSize;
+	view.camera = Camera(	vec4d( -280.0, -30.0, 50.0, 0.0 ),
+							vec4d( 0.0, -1.0, 0.0, 0.0 ),
+							vec4d( 0.0, 0.0, -1.0, 0.0 ),
+							vec4d( -1.0, 0.0, 0.0, 0.0 ),
+							CameraFov,
+							AspectRatio( view.targetSize ),
+							CameraNearPlane,
+							CameraFarPlane );
 
-				const vec4d diffuseIntensity = Multiply( D, intensity ) * std::max( 0.0, Dot( lightDir, surfaceSample.normal ) );
+	view.viewTransform = view.camera.ToViewMatrix();
+	view.projTransform = view.camera.ToPerspectiveProjMatrix();
+	view.projView = view.projTransform * view.viewTransform;
+	view.prevProjView = view.projView;
 
-				const vec4d specularIntensity = S * pow( std::max( 0.0, Dot( surfaceSample.normal, halfVector ) ), material.Ns );
-				
-				shadingColor += Vec4dToColor( specularIntensity );
-				shadingColor += Vec4dToColor( Multiply( diffuseIntensity, ColorToVector( surfaceColor ) ) );
-			}
+	return view;
+}
 
-			finalColor += shadingColor + relfectionColor;
-		}
 
-		const Color ambient = AmbientLight * ( Color( material.Ka ) * surfaceColor );
+SceneView SetupTopView()
+{
+	SceneView view;
 
-		sample = surfaceSample;
-		sample.color = finalColor + ambient;
-		return sample;
-	}
+	view.targetSize = RenderSize;
+	view.camera = Camera(	vec4d( 0.0, 0.0, 280.0, 0.0 ),
+							vec4d( 0.0, -1.0, 0.0, 0.0 ),
+							vec4d( -1.0, 0.0, 0.0, 0.0 ),
+							vec4d( 0.0, 0.0, 1.0, 0.0 ),
+							CameraFov,
+							AspectRatio( view.targetSize ),
+							CameraNearPlane,
+							CameraFarPlane );
 
-	return sample;
+	view.viewTransform = view.camera.ToViewMatrix();
+	view.projTransform = view.camera.ToPerspectiveProjMatrix();
+	view.projView = view.projTransform * view.viewTransform;
+	view.prevProjView = view.projView;
+
+	return view;
 }
 
 
-SceneView SetupFrontView()
+SceneView SetupSideView()
 {
 	SceneView view;
 
 	view.targetSize = RenderSize;
-	view.camera = Camera(	vec4d( -280.0, -30.0, 50.0, 0.0 ),
-							vec4d( 0.0, -1.0, 0.0, 0.0 ),
-							vec4d( 0.0, 0.0, -1.0, 0.0 ),
+	view.camera = Camera(	vec4d( 0.0, 280.0, 0.0, 0.0 ),
 							vec4d( -1.0, 0.0, 0.0, 0.0 ),
+							vec4d( 0.0, 0.0, -1.0, 0.0 ),
+							vec4d( 0.0, 1.0, 0.0, 0.0 ),
 							CameraFov,
 							AspectRatio( view.targetSize ),
 							CameraNearPlane,
@@ -296,208 +592,1206 @@ SceneView SetupFrontView()
 	view.viewTransform = view.camera.ToViewMatrix();
 	view.projTransform = view.camera.ToPerspectiveProjMatrix();
 	view.projView = view.projTransform * view.viewTransform;
+	view.prevProjView = view.projView;
+
+	return view;
+}
+
+
+void SetupViews()
+{
+	views[ VIEW_CAMERA ] = SetupFrontView();
+	views[ VIEW_FRONT ] = SetupFrontView();
+	views[ VIEW_TOP ] = SetupTopView();
+	views[ VIEW_SIDE ] = SetupSideView();
+}
+
+
+#if USE_ADAPTIVE
+static const uint32_t SubSampleCnt = AdaptiveMaxSamples; // Upper bound; converged pixels stop early
+#elif USE_PROGRESSIVE
+static const uint32_t SubSampleCnt = ProgressiveMaxSamples; // Upper bound; the time budget usually ends refinement first
+#elif USE_SSRAND
+static const uint32_t SubSampleCnt = 100;
+#elif USE_SS4X
+static const uint32_t SubSampleCnt = 4;
+#else
+static const uint32_t SubSampleCnt = 1;
+#endif
+
+
+// AOV fields exist only for the channels in TraceChannels
+struct pixelAccum_t
+{
+	Color		color;
+	double		coverage;
+	uint32_t	sampleCnt;
+	double		lumMean;	// Running mean and squared deviation of sample luminance (Welford)
+	double		lumM2;
+#if TRACE_AOV_FACING
+	double		diffuse; // Eye-to-Surface
+#endif
+#if TRACE_AOV_NORMAL
+	vec3d		normal;
+#endif
+#if TRACE_AOV_ALBEDO
+	Color		albedo;
+#endif
+#if TRACE_AOV_SURFACE
+	uint32_t	surfaceCnt;
+#endif
+#if TRACE_AOV_DEPTH
+	double		depth;
+#endif
+#if TRACE_AOV_HITCOUNT
+	uint32_t	hitCnt;
+#endif
+	// Identifiers and motion come from the first subsample that hits a surface
+#if TRACE_AOV_INSTANCE
+	uint32_t	instanceIx;
+#endif
+#if TRACE_AOV_MATERIAL
+	int32_t		materialId;
+#endif
+#if TRACE_AOV_MOTION
+	vec3d		primaryPt;
+#endif
+};
+
+#if USE_ADAPTIVE
+std::atomic<uint64_t> adaptiveSampleCnt( 0 );
+#endif
+
+
+// Final values of one pixel, written to the target and debug images on commit
+struct resolvedPixel_t
+{
+	Color		color;		// Linear with coverage in alpha, blended over the target as sRGB
+	bool		covered;
+#if TRACE_AOV_SURFACE
+	bool		surface;	// At least one subsample hit geometry
+#endif
+#if TRACE_AOV_ALBEDO
+	Color		albedo;		// Linear
+#endif
+#if TRACE_AOV_NORMAL
+	vec3d		normal;
+#endif
+#if TRACE_AOV_DEPTH
+	float		depth;
+#endif
+	// R8G8B8A8 from here on
+#if TRACE_AOV_FACING
+	uint32_t	diffuse;
+#endif
+#if TRACE_AOV_INSTANCE
+	uint32_t	instanceId;
+#endif
+#if TRACE_AOV_MATERIAL
+	uint32_t	materialId;
+#endif
+#if TRACE_AOV_HITCOUNT
+	uint32_t	hitCount;
+#endif
+#if TRACE_AOV_MOTION
+	uint32_t	motion;
+#endif
+};
+
+// Resolved pixels of one trace tile. A worker only writes its own tile; the shared images are
+// written once every tile is done, so threads never share cache lines while tracing.
+struct alignas( CacheLineSize ) tileBuffer_t
+{
+	resolvedPixel_t	pixels[ TileSize * TileSize ];
+	vec2i			p0;
+	vec2i			p1;
+
+	resolvedPixel_t& At( const uint32_t px, const uint32_t py )
+	{
+		return pixels[ ( py - p0[ 1 ] ) * TileSize + ( px - p0[ 0 ] ) ];
+	}
+
+	const resolvedPixel_t& At( const uint32_t px, const uint32_t py ) const
+	{
+		return pixels[ ( py - p0[ 1 ] ) * TileSize + ( px - p0[ 0 ] ) ];
+	}
+};
+
+
+inline uint32_t PixelIndex( const SceneView& view, const uint32_t px, const uint32_t py )
+{
+	return py * static_cast<uint32_t>( view.targetSize[ 0 ] ) + px;
+}
+
+
+vec2d GetSubPixelOffset( const uint32_t pixelIx, const uint32_t subSampleIx )
+{
+#if	USE_SSRAND || USE_ADAPTIVE || USE_PROGRESSIVE
+	return Sample2D( MakeSampler( PixelSampler, pixelIx, subSampleIx ), SampleDimPixel );
+#elif USE_SS4X
+	static const vec2d offsets[ SubSampleCnt ] = { vec2d( 0.25, 0.25 ), vec2d( 0.75, 0.25 ), vec2d( 0.25, 0.75 ), vec2d( 0.75, 0.75 ) };
+	return offsets[ subSampleIx ];
+#else
+	return vec2d( 0.5, 0.5 );
+#endif
+}
+
+
+Ray GetPixelRay( const SceneView& view, const uint32_t px, const uint32_t py, const vec2d& subPixelOffset )
+{
+	vec2d pixelXY = vec2d( static_cast<double>( px ), static_cast<double>( py ) );
+	pixelXY += subPixelOffset;
+	vec2d uv = vec2d( pixelXY[ 0 ] / ( view.targetSize[ 0 ] - 1.0 ), pixelXY[ 1 ] / ( view.targetSize[ 1 ] - 1.0 ) );
+
+	return view.camera.GetViewRay( uv );
+}
+
+
+void ClearPixelAccum( pixelAccum_t& accum )
+{
+	accum.color = Color::Black;
+	accum.coverage = 0.0;
+	accum.sampleCnt = 0;
+	accum.lumMean = 0.0;
+	accum.lumM2 = 0.0;
+#if TRACE_AOV_FACING
+	accum.diffuse = 0.0;
+#endif
+#if TRACE_AOV_NORMAL
+	accum.normal = vec3d( 0.0, 0.0, 0.0 );
+#endif
+#if TRACE_AOV_ALBEDO
+	accum.albedo = Color::Black;
+#endif
+#if TRACE_AOV_SURFACE
+	accum.surfaceCnt = 0;
+#endif
+#if TRACE_AOV_DEPTH
+	accum.depth = 0.0;
+#endif
+#if TRACE_AOV_HITCOUNT
+	accum.hitCnt = 0;
+#endif
+#if TRACE_AOV_INSTANCE
+	accum.instanceIx = ResourceManager::InvalidModelIx;
+#endif
+#if TRACE_AOV_MATERIAL
+	accum.materialId = -1;
+#endif
+#if TRACE_AOV_MOTION
+	accum.primaryPt = vec3d( 0.0 );
+#endif
+}
+
+
+void AccumulateSample( pixelAccum_t& accum, const sample_t& sample )
+{
+	accum.color += sample.color;
+	accum.coverage += sample.hitCode != HIT_NONE ? 1.0 : 0.0;
+
+#if TRACE_AOV_FACING
+	accum.diffuse += sample.surfaceDot;
+#endif
+#if TRACE_AOV_NORMAL
+	accum.normal += sample.normal;
+#endif
+#if TRACE_AOV_ALBEDO
+	if ( sample.hitCode != HIT_NONE )
+	{
+		accum.albedo += sample.albedo;
+	}
+#endif
+
+#if TRACE_AOV_SURFACE
+	const bool surfaceHit = ( sample.hitCode == HIT_FRONTFACE ) || ( sample.hitCode == HIT_BACKFACE );
+	if ( surfaceHit )
+	{
+		if ( accum.surfaceCnt == 0 )
+		{
+#if TRACE_AOV_INSTANCE
+			accum.instanceIx = sample.instanceIx;
+#endif
+#if TRACE_AOV_MATERIAL
+			accum.materialId = sample.materialId;
+#endif
+#if TRACE_AOV_MOTION
+			accum.primaryPt = sample.pt;
+#endif
+		}
+#if TRACE_AOV_DEPTH
+		accum.depth += sample.t;
+#endif
+#if TRACE_AOV_HITCOUNT
+		accum.hitCnt += sample.hitCnt;
+#endif
+		accum.surfaceCnt++;
+	}
+#endif
+
+	const rgbaf_t& c = sample.color.rgba();
+	const double lum = 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b;
+	accum.sampleCnt++;
+	const double delta = lum - accum.lumMean;
+	accum.lumMean += delta / accum.sampleCnt;
+	accum.lumM2 += delta * ( lum - accum.lumMean );
+}
+
+// Fixed sampling takes SubSampleCnt subsamples. Adaptive sampling stops once the standard
+// error of the pixel's mean luminance falls below AdaptiveMaxError.
+bool NeedsSample( const pixelAccum_t& accum )
+{
+	if ( accum.sampleCnt >= SubSampleCnt )
+	{
+		return false;
+	}
+#if USE_ADAPTIVE
+	if ( accum.sampleCnt < AdaptiveMinSamples )
+	{
+		return true;
+	}
+	const double variance = accum.lumM2 / ( accum.sampleCnt - 1 );
+	return sqrt( variance / accum.sampleCnt ) > AdaptiveMaxError;
+#else
+	return true;
+#endif
+}
+
+
+// Screen-space offset of a world point from the previous frame to this one, in pixels
+vec2d MotionVector( const SceneView& view, const vec3d& pt )
+{
+	vec4d prev;
+	vec4d curr;
+	ProjectPoint( view.prevProjView, view.targetSize, vec4d( pt, 1.0 ), prev );
+	ProjectPoint( view.projView, view.targetSize, vec4d( pt, 1.0 ), curr );
+	return vec2d( curr[ 0 ] - prev[ 0 ], curr[ 1 ] - prev[ 1 ] );
+}
+
+
+resolvedPixel_t ResolvePixel( const SceneView& view, const pixelAccum_t& accum )
+{
+	resolvedPixel_t resolved;
+	resolved.covered = ( accum.coverage > 0.0 );
+	if ( resolved.covered )
+	{
+		const double coverage = accum.coverage / accum.sampleCnt;
+
+		resolved.color = ( 1.0f / accum.sampleCnt ) * accum.color;
+		resolved.color.rgba().a = (float)coverage;
+
+#if TRACE_AOV_FACING
+		const double diffuse = accum.diffuse / accum.sampleCnt;
+		resolved.diffuse = Color( (float)-diffuse ).AsR8G8B8A8();
+#endif
+#if TRACE_AOV_NORMAL
+		resolved.normal = accum.normal.Normalize();
+#endif
+#if TRACE_AOV_ALBEDO
+		resolved.albedo = ( 1.0f / accum.sampleCnt ) * accum.albedo;
+#endif
+
+#if TRACE_AOV_SURFACE
+		const bool hasSurface = ( accum.surfaceCnt > 0 );
+		resolved.surface = hasSurface;
+#endif
+#if TRACE_AOV_DEPTH
+		resolved.depth = hasSurface ? static_cast<float>( accum.depth / accum.surfaceCnt ) : 0.0f;
+#endif
+#if TRACE_AOV_INSTANCE
+		resolved.instanceId = ( hasSurface ? DbgColors[ accum.instanceIx % 16 ] : Color( Color::Black ) ).AsR8G8B8A8();
+#endif
+#if TRACE_AOV_MATERIAL
+		resolved.materialId = ( hasSurface ? DbgColors[ accum.materialId % 16 ] : Color( Color::Black ) ).AsR8G8B8A8();
+#endif
+#if TRACE_AOV_HITCOUNT
+		resolved.hitCount = Color( static_cast<float>( accum.hitCnt / ( accum.sampleCnt * ( MaxBounces + 1.0 ) ) ) ).AsR8G8B8A8();
+#endif
+#if TRACE_AOV_MOTION
+		const vec2d motion = hasSurface ? MotionVector( view, accum.primaryPt ) : vec2d( 0.0, 0.0 );
+		resolved.motion = Color( static_cast<float>( 0.5 + motion[ 0 ] / view.targetSize[ 0 ] ), static_cast<float>( 0.5 + motion[ 1 ] / view.targetSize[ 1 ] ), 0.5f ).AsR8G8B8A8();
+#endif
+	}
+	return resolved;
+}
+
+void CommitPixel( Image<Color>& image, const uint32_t px, const uint32_t py, const resolvedPixel_t& resolved )
+{
+	if ( resolved.covered )
+	{
+		int32_t imageX = static_cast<int32_t>( px );
+		int32_t imageY = static_cast<int32_t>( py );
+
+#if USE_AOV_FACING
+		dbg.diffuse.SetPixel( imageX, imageY, resolved.diffuse );
+#endif
+#if USE_AOV_NORMAL
+		// normal = normal.Reverse();
+		Color normColor = Vec4dToColor( vec4d( 0.5 * resolved.normal + vec3d( 0.5 ), 1.0 ) );
+		dbg.normal.SetPixel( imageX, imageY, normColor.AsR8G8B8A8() );
+#endif
+#if USE_AOV_ALBEDO
+		dbg.albedo.SetPixel( imageX, imageY, Color( LinearToSrgb( resolved.albedo ) ).AsR8G8B8A8() );
+#endif
+#if USE_AOV_DEPTH
+		depthBuffer.SetPixel( imageX, imageY, resolved.depth );
+#endif
+#if USE_AOV_INSTANCE
+		dbg.instanceId.SetPixel( imageX, imageY, resolved.instanceId );
+#endif
+#if USE_AOV_MATERIAL
+		dbg.materialId.SetPixel( imageX, imageY, resolved.materialId );
+#endif
+#if USE_AOV_HITCOUNT
+		dbg.hitCount.SetPixel( imageX, imageY, resolved.hitCount );
+#endif
+#if USE_AOV_MOTION
+		dbg.motion.SetPixel( imageX, imageY, resolved.motion );
+#endif
+
+		Color dest = Color( image.GetPixel( imageX, imageY ) );
+
+		// Only RGB is encoded; alpha is coverage and must reach the blend as resolved
+		Color srgb = Color( LinearToSrgb( resolved.color ) );
+		srgb.rgba().a = resolved.color.rgba().a;
+
+		Color pixel = BlendColor( srgb, dest, blendMode_t::SRCALPHA );
+		image.SetPixel( imageX, imageY, pixel );
+	}
+}
+
+
+void CommitTile( Image<Color>& image, const tileBuffer_t& tile )
+{
+	for ( uint32_t py = tile.p0[ 1 ]; py < static_cast<uint32_t>( tile.p1[ 1 ] ); ++py )
+	{
+		for ( uint32_t px = tile.p0[ 0 ]; px < static_cast<uint32_t>( tile.p1[ 0 ] ); ++px )
+		{
+			CommitPixel( image, px, py, tile.At( px, py ) );
+		}
+	}
+}
+
+
+#if USE_DENOISE
+// Filters the color of resolved pixels in place. pixelAt( px, py ) returns the pixel at image coordinates.
+// Only the RGB of pixels with a surface changes; coverage and the AOVs are kept as traced.
+template<typename PixelFunc>
+void DenoiseResolved( const uint32_t width, const uint32_t height, PixelFunc&& pixelAt )
+{
+	denoiseBuffer_t buffer;
+	buffer.Resize( width, height );
+
+	threadPool.ParallelFor( height, [&]( const uint32_t py, const uint32_t workerIx )
+	{
+		for ( uint32_t px = 0; px < width; ++px )
+		{
+			const resolvedPixel_t& resolved = pixelAt( px, py );
+			if ( !resolved.covered || !resolved.surface )
+			{
+				continue;
+			}
+
+			const size_t p = static_cast<size_t>( py ) * width + px;
+			const rgbaf_t& color = resolved.color.rgba();
+			const rgbaf_t& albedo = resolved.albedo.rgba();
+			buffer.color[ 0 ][ p ] = color.r;
+			buffer.color[ 1 ][ p ] = color.g;
+			buffer.color[ 2 ][ p ] = color.b;
+			buffer.albedo[ 0 ][ p ] = albedo.r;
+			buffer.albedo[ 1 ][ p ] = albedo.g;
+			buffer.albedo[ 2 ][ p ] = albedo.b;
+			for ( int32_t i = 0; i < 3; ++i )
+			{
+				buffer.normal[ i ][ p ] = static_cast<float>( resolved.normal[ i ] );
+			}
+			buffer.depth[ p ] = resolved.depth;
+			buffer.surface[ p ] = 1;
+		}
+	} );
+
+	Denoise( buffer, threadPool );
+
+	threadPool.ParallelFor( height, [&]( const uint32_t py, const uint32_t workerIx )
+	{
+		for ( uint32_t px = 0; px < width; ++px )
+		{
+			const size_t p = static_cast<size_t>( py ) * width + px;
+			if ( buffer.surface[ p ] )
+			{
+				rgbaf_t& color = pixelAt( px, py ).color.rgba();
+				color.r = buffer.color[ 0 ][ p ];
+				color.g = buffer.color[ 1 ][ p ];
+				color.b = buffer.color[ 2 ][ p ];
+			}
+		}
+	} );
+}
+#endif
+
+
+// Resolves a whole image from its accumulators, denoises it and commits it one row per task.
+// accumAt( px, py ) returns the accumulator to resolve for a pixel.
+template<typename AccumFunc>
+void ResolveImage( const SceneView& view, Image<Color>& image, const uint32_t width, const uint32_t height, AccumFunc&& accumAt )
+{
+	std::vector<resolvedPixel_t> resolved( static_cast<size_t>( width ) * height );
+
+	threadPool.ParallelFor( height, [&]( const uint32_t py, const uint32_t workerIx )
+	{
+		for ( uint32_t px = 0; px < width; ++px )
+		{
+			resolved[ py * width + px ] = ResolvePixel( view, accumAt( px, py ) );
+		}
+	} );
+
+#if USE_DENOISE
+	DenoiseResolved( width, height, [&]( const uint32_t px, const uint32_t py ) -> resolvedPixel_t&
+	{
+		return resolved[ py * width + px ];
+	} );
+#endif
+
+	threadPool.ParallelFor( height, [&]( const uint32_t py, const uint32_t workerIx )
+	{
+		for ( uint32_t px = 0; px < width; ++px )
+		{
+			CommitPixel( image, px, py, resolved[ py * width + px ] );
+		}
+	} );
+}
+
+
+// Traces subsample accum.sampleCnt of a pixel and adds it to the accumulator
+template<typename T>
+void TraceSubSample( const SceneView& view, const uint32_t px, const uint32_t py, pixelAccum_t& accum )
+{
+	const uint32_t pixelIx = PixelIndex( view, px, py );
+	const uint32_t s = accum.sampleCnt;
+
+	const sampler_t sampler = MakeSampler( PixelSampler, pixelIx, s );
+	Ray ray = GetPixelRay( view, px, py, GetSubPixelOffset( pixelIx, s ) );
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Experimental
+	const vec3d up = vec3d( 0.0, 0.0, 1.0 );
+	const vec3d z = ray.GetVector();
+	const vec3d x = Cross( up, z );
+	const vec3d y = Cross( x, z );
+
+	const vec2d e = SampleCircle( sampler, SampleDimLens );
+	const vec4d r = vec4d( e[ 0 ], e[ 1 ], 0.0, 0.0 );
+	
+	const mat4x4d m = CreateMatrix4x4(	x[ 0 ], x[ 1 ], x[ 2 ], 0.0,
+										y[ 0 ], y[ 1 ], y[ 2 ], 0.0,
+										z[ 0 ], z[ 1 ], z[ 2 ], 0.0,
+										0.0,	0.0,	0.0,	1.0 );
+
+	const vec4d perturb = m * r;
+
+	//ray.d = ray.d + Trunc<4,1>( 0.01 * perturb );
+	//assert( ( Dot( x, z ) < 1e6 ) && ( Dot( x, y ) < 1e6 ) && ( Dot( y, z ) < 1e6 ) );
+	//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	const sample_t sample = RayTrace_r<T>( ray, sampler, 0 );
+	AccumulateSample( accum, sample );
+}
+
+
+template<typename T>
+void TracePixel( const SceneView& view, tileBuffer_t& tile, const uint32_t px, const uint32_t py )
+{
+	pixelAccum_t accum;
+	ClearPixelAccum( accum );
+
+	while ( NeedsSample( accum ) ) // Subsamples
+	{
+		TraceSubSample<T>( view, px, py, accum );
+	}
+
+#if USE_ADAPTIVE
+	adaptiveSampleCnt += accum.sampleCnt;
+#endif
+	tile.At( px, py ) = ResolvePixel( view, accum );
+}
+
+
+// Traces the next subsample of every active lane that still needs one as a single packet, then
+// shades each lane with the scalar path. Returns false, tracing nothing, once no lane needs a sample.
+template<uint32_t N, typename T>
+bool TracePacketSample( const SceneView& view, const uint32_t laneX[ N ], const uint32_t laneY[ N ], const bool laneActive[ N ], pixelAccum_t* const laneAccum[ N ] )
+{
+	bool laneLive[ N ];
+	uint32_t firstLive = N;
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		laneLive[ lane ] = laneActive[ lane ] && NeedsSample( *laneAccum[ lane ] );
+		if ( laneLive[ lane ] && ( firstLive == N ) )
+		{
+			firstLive = lane;
+		}
+	}
+
+	if ( firstLive == N )
+	{
+		return false;
+	}
+
+	rayPacket_t<N, T> packet;
+	packetHit_t<N, T> hits;
+	Ray rays[ N ];
+	bool inScene[ N ];
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		// Idle lanes repeat a live ray with a negative tMax so they never report a hit
+		const uint32_t srcLane = laneLive[ lane ] ? lane : firstLive;
+		const uint32_t pixelIx = PixelIndex( view, laneX[ srcLane ], laneY[ srcLane ] );
+		rays[ lane ] = GetPixelRay( view, laneX[ srcLane ], laneY[ srcLane ], GetSubPixelOffset( pixelIx, laneAccum[ srcLane ]->sampleCnt ) );
+		SetPacketRay<N, T>( packet, lane, rays[ lane ] );
+
+		inScene[ lane ] = laneLive[ lane ];
+#if USE_AABB
+		double tnear = 0;
+		double tfar = 0;
+		inScene[ lane ] = inScene[ lane ] && scene.aabb.Intersect( rays[ lane ], tnear, tfar );
+#endif
+		hits.t[ lane ] = inScene[ lane ] ? std::numeric_limits<T>::max() : T( -1 );
+		hits.instanceIx[ lane ] = ResourceManager::InvalidModelIx;
+	}
+
+	IntersectScenePacket<N, T>( packet, true, hits );
+
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		if ( !laneLive[ lane ] )
+		{
+			continue;
+		}
+
+		sample_t sample;
+		if ( !inScene[ lane ] )
+		{
+			sample.color = Color::Black;
+			sample.hitCode = HIT_NONE;
+		}
+		else if ( hits.instanceIx[ lane ] == ResourceManager::InvalidModelIx )
+		{
+			sample = RecordSkyInfo( rays[ lane ], DBL_MAX );
+		}
+		else
+		{
+			hit_t<T> hit;
+			hit.t = hits.t[ lane ];
+			hit.u = hits.u[ lane ];
+			hit.v = hits.v[ lane ];
+			hit.triIx = hits.triIx[ lane ];
+			hit.instanceIx = hits.instanceIx[ lane ];
+
+			const sampler_t sampler = MakeSampler( PixelSampler, PixelIndex( view, laneX[ lane ], laneY[ lane ] ), laneAccum[ lane ]->sampleCnt );
+			const sample_t surfaceSample = RecordSurfaceInfo( rays[ lane ], hit );
+			sample = ShadeSurface<T>( rays[ lane ], surfaceSample, sampler, 0 );
+		}
+		AccumulateSample( *laneAccum[ lane ], sample );
+	}
+
+	return true;
+}
+
+
+// Traces all subsamples for a block of N pixels, one packet per subsample.
+// Lanes drop out as their pixels converge; the block is done once every lane has.
+template<uint32_t N, typename T>
+void TracePacketBlock( const SceneView& view, tileBuffer_t& tile, const uint32_t bx, const uint32_t by, const uint32_t xEnd, const uint32_t yEnd )
+{
+	static const uint32_t BlockWidth = ( N >= 8 ) ? 4 : 2;
+
+	uint32_t laneX[ N ];
+	uint32_t laneY[ N ];
+	bool laneActive[ N ];
+	pixelAccum_t accum[ N ];
+	pixelAccum_t* laneAccum[ N ];
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		laneX[ lane ] = bx + ( lane % BlockWidth );
+		laneY[ lane ] = by + ( lane / BlockWidth );
+		laneActive[ lane ] = ( laneX[ lane ] < xEnd ) && ( laneY[ lane ] < yEnd );
+		ClearPixelAccum( accum[ lane ] );
+		laneAccum[ lane ] = &accum[ lane ];
+	}
+
+	while ( TracePacketSample<N, T>( view, laneX, laneY, laneActive, laneAccum ) )
+	{
+	}
+
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		if ( laneActive[ lane ] )
+		{
+#if USE_ADAPTIVE
+			adaptiveSampleCnt += accum[ lane ].sampleCnt;
+#endif
+			tile.At( laneX[ lane ], laneY[ lane ] ) = ResolvePixel( view, accum[ lane ] );
+		}
+	}
+}
+
+
+template<uint32_t N>
+void TracePatchPackets( const SceneView& view, tileBuffer_t& tile )
+{
+	static const uint32_t BlockWidth = ( N >= 8 ) ? 4 : 2;
+	static const uint32_t BlockHeight = N / BlockWidth;
+
+	const uint32_t xEnd = tile.p1[ 0 ];
+	const uint32_t yEnd = tile.p1[ 1 ];
+
+	for ( uint32_t by = tile.p0[ 1 ]; by < yEnd; by += BlockHeight )
+	{
+		for ( uint32_t bx = tile.p0[ 0 ]; bx < xEnd; bx += BlockWidth )
+		{
+			TracePacketBlock<N, real_t>( view, tile, bx, by, xEnd, yEnd );
+		}
+	}
+}
+
+
+// Traces every pixel in [tile.p0, tile.p1), which must lie within the target image
+void TracePatch( const SceneView& view, tileBuffer_t& tile )
+{
+#if USE_PACKETS
+	static const uint32_t packetWidth = PacketWidth<real_t>( DetectSimdLevel() );
+	switch ( packetWidth )
+	{
+	case 16:	TracePatchPackets<16>( view, tile ); return;
+	case 8:		TracePatchPackets<8>( view, tile ); return;
+	case 4:		TracePatchPackets<4>( view, tile ); return;
+	default:	TracePatchPackets<2>( view, tile ); return;
+	}
+#else
+	const int32_t x0 = tile.p0[ 0 ];
+	const int32_t y0 = tile.p0[ 1 ];
+	const int32_t x1 = tile.p1[ 0 ];
+	const int32_t y1 = tile.p1[ 1 ];
+
+	for ( uint32_t py = y0; py < y1; ++py )
+	{
+		for ( uint32_t px = x0; px < x1; ++px )
+		{
+			TracePixel<real_t>( view, tile, px, py );
+		}
+	}
+#endif
+}
+
+
+#if USE_PROGRESSIVE
+template<uint32_t N>
+uint32_t RefinePatchPackets( const SceneView& view, std::vector<pixelAccum_t>& accum, const vec2i& p0, const vec2i& p1, const uint32_t stride )
+{
+	uint32_t laneX[ N ];
+	uint32_t laneY[ N ];
+	bool laneActive[ N ];
+	pixelAccum_t* laneAccum[ N ];
+	uint32_t laneCnt = 0;
+	uint32_t refineCnt = 0;
+
+	// Pixels that still need a sample are gathered into packets in scan order
+	for ( uint32_t py = p0[ 1 ]; py < static_cast<uint32_t>( p1[ 1 ] ); py += stride )
+	{
+		for ( uint32_t px = p0[ 0 ]; px < static_cast<uint32_t>( p1[ 0 ] ); px += stride )
+		{
+			pixelAccum_t& pixelAccum = accum[ PixelIndex( view, px, py ) ];
+			if ( !NeedsSample( pixelAccum ) )
+			{
+				continue;
+			}
+
+			laneX[ laneCnt ] = px;
+			laneY[ laneCnt ] = py;
+			laneActive[ laneCnt ] = true;
+			laneAccum[ laneCnt ] = &pixelAccum;
+			++refineCnt;
+
+			if ( ++laneCnt == N )
+			{
+				TracePacketSample<N, real_t>( view, laneX, laneY, laneActive, laneAccum );
+				laneCnt = 0;
+			}
+		}
+	}
+
+	if ( laneCnt > 0 )
+	{
+		for ( uint32_t lane = laneCnt; lane < N; ++lane )
+		{
+			laneX[ lane ] = laneX[ 0 ];
+			laneY[ lane ] = laneY[ 0 ];
+			laneActive[ lane ] = false;
+			laneAccum[ lane ] = laneAccum[ 0 ];
+		}
+		TracePacketSample<N, real_t>( view, laneX, laneY, laneActive, laneAccum );
+	}
+
+	return refineCnt;
+}
+
+
+// Adds one subsample to each pixel on the stride grid in [p0, p1) that still needs one.
+// Returns the number of pixels refined.
+uint32_t RefinePatch( const SceneView& view, std::vector<pixelAccum_t>& accum, const vec2i& p0, const vec2i& p1, const uint32_t stride )
+{
+#if USE_PACKETS
+	static const uint32_t packetWidth = PacketWidth<real_t>( DetectSimdLevel() );
+	switch ( packetWidth )
+	{
+	case 16:	return RefinePatchPackets<16>( view, accum, p0, p1, stride );
+	case 8:		return RefinePatchPackets<8>( view, accum, p0, p1, stride );
+	case 4:		return RefinePatchPackets<4>( view, accum, p0, p1, stride );
+	default:	return RefinePatchPackets<2>( view, accum, p0, p1, stride );
+	}
+#else
+	uint32_t refineCnt = 0;
+	for ( uint32_t py = p0[ 1 ]; py < static_cast<uint32_t>( p1[ 1 ] ); py += stride )
+	{
+		for ( uint32_t px = p0[ 0 ]; px < static_cast<uint32_t>( p1[ 0 ] ); px += stride )
+		{
+			pixelAccum_t& pixelAccum = accum[ PixelIndex( view, px, py ) ];
+			if ( NeedsSample( pixelAccum ) )
+			{
+				TraceSubSample<real_t>( view, px, py, pixelAccum );
+				++refineCnt;
+			}
+		}
+	}
+	return refineCnt;
+#endif
+}
+
+
+// Renders in passes against a wall-clock deadline and resolves whatever has accumulated when it passes.
+// The first pass takes one sample per ProgressivePreviewStride block and always completes. Later passes
+// add a subsample to every pixel, skipping tiles that start after the deadline.
+void TraceSceneProgressive( const SceneView& view, Image<Color>& image, const uint32_t tileSize )
+{
+	// Preview blocks must not straddle tiles, or resolve would read blocks no tile sampled
+	assert( ( tileSize % ProgressivePreviewStride ) == 0 );
+
+	Timer budgetTimer;
+	budgetTimer.Start();
+
+	const uint32_t renderWidth = std::min( static_cast<uint32_t>( view.targetSize[ 0 ] ), image.GetWidth() );
+	const uint32_t renderHeight = std::min( static_cast<uint32_t>( view.targetSize[ 1 ] ), image.GetHeight() );
+
+	std::vector<pixelAccum_t> accum( static_cast<uint32_t>( view.targetSize[ 0 ] ) * renderHeight );
+	for ( pixelAccum_t& pixelAccum : accum )
+	{
+		ClearPixelAccum( pixelAccum );
+	}
+
+	const uint32_t tilesX = ( renderWidth + tileSize - 1 ) / tileSize;
+	const uint32_t tilesY = ( renderHeight + tileSize - 1 ) / tileSize;
+
+	uint32_t passCnt = 0;
+	uint32_t stride = ProgressivePreviewStride;
+	while ( ( passCnt == 0 ) || ( budgetTimer.GetElapsedSinceStart() < ProgressiveBudgetMs ) )
+	{
+		std::atomic<uint32_t> refineCnt( 0 );
+		threadPool.ParallelFor( tilesX * tilesY, [&]( const uint32_t tileIx, const uint32_t workerIx )
+		{
+			if ( ( passCnt > 0 ) && ( budgetTimer.GetElapsedSinceStart() >= ProgressiveBudgetMs ) )
+			{
+				return;
+			}
+
+			const uint32_t px = ( tileIx % tilesX ) * tileSize;
+			const uint32_t py = ( tileIx / tilesX ) * tileSize;
+
+			vec2i patch;
+			patch[ 0 ] = Clamp( px + tileSize, px, renderWidth );
+			patch[ 1 ] = Clamp( py + tileSize, py, renderHeight );
+
+			refineCnt += RefinePatch( view, accum, vec2i( px, py ), patch, stride );
+		} );
+
+		if ( refineCnt == 0 )
+		{
+			break;
+		}
+		++passCnt;
+		stride = 1;
+	}
+
+#if USE_ADAPTIVE
+	for ( const pixelAccum_t& pixelAccum : accum )
+	{
+		adaptiveSampleCnt += pixelAccum.sampleCnt;
+	}
+#endif
+
+	// Pixels the passes never reached show the preview sample of their block
+	ResolveImage( view, image, renderWidth, renderHeight, [&]( const uint32_t px, const uint32_t py ) -> const pixelAccum_t&
+	{
+		const pixelAccum_t& pixelAccum = accum[ PixelIndex( view, px, py ) ];
+		const uint32_t previewX = px - ( px % ProgressivePreviewStride );
+		const uint32_t previewY = py - ( py % ProgressivePreviewStride );
+		return ( pixelAccum.sampleCnt > 0 ) ? pixelAccum : accum[ PixelIndex( view, previewX, previewY ) ];
+	} );
 
-	return view;
+	std::cout << passCnt << " passes";
 }
+#endif
 
 
-SceneView SetupTopView()
+#if USE_WAVEFRONT
+struct wavefront_t
 {
-	SceneView view;
+	pathState_t			paths;
+	rayQueue_t			rays[ 2 ];	// Rays being extended and rays queued for the next bounce
+	hitQueue_t<real_t>	hits;
+	shadowQueue_t		shadows;
+	uint32_t			width;
+	uint32_t			height;
+};
+
+
+// Runs func( entryIx ) over a queue, WavefrontChunkSize entries per task
+template<typename Func>
+void ParallelForQueue( const uint32_t entryCnt, Func&& func )
+{
+	const uint32_t chunkCnt = ( entryCnt + WavefrontChunkSize - 1 ) / WavefrontChunkSize;
+	threadPool.ParallelFor( chunkCnt, [&]( const uint32_t chunkIx, const uint32_t workerIx )
+	{
+		const uint32_t first = chunkIx * WavefrontChunkSize;
+		const uint32_t last = std::min( first + WavefrontChunkSize, entryCnt );
+		for ( uint32_t i = first; i < last; ++i )
+		{
+			func( i );
+		}
+	} );
+}
 
-	view.targetSize = RenderSize;
-	view.camera = Camera(	vec4d( 0.0, 0.0, 280.0, 0.0 ),
-							vec4d( 0.0, -1.0, 0.0, 0.0 ),
-							vec4d( -1.0, 0.0, 0.0, 0.0 ),
-							vec4d( 0.0, 0.0, 1.0, 0.0 ),
-							CameraFov,
-							AspectRatio( view.targetSize ),
-							CameraNearPlane,
-							CameraFarPlane );
 
-	view.viewTransform = view.camera.ToViewMatrix();
-	view.projTransform = view.camera.ToPerspectiveProjMatrix();
-	view.projView = view.projTransform * view.viewTransform;
+// One primary ray for subsample s per pixel that still needs samples. Rays that miss the scene
+// bounds never enter the queue. Returns the number of pixels taking subsample s.
+uint32_t GenerateStage( const SceneView& view, wavefront_t& wf, const std::vector<pixelAccum_t>& accum, const uint32_t s )
+{
+	rayQueue_t& queue = wf.rays[ 0 ];
+	queue.count = 0;
 
-	return view;
-}
+	std::atomic<uint32_t> liveCnt( 0 );
+	ParallelForQueue( wf.width * wf.height, [&]( const uint32_t pathIx )
+	{
+		const uint32_t px = pathIx % wf.width;
+		const uint32_t py = pathIx / wf.width;
 
+		wf.paths.px[ pathIx ] = px;
+		wf.paths.py[ pathIx ] = py;
+		if ( !NeedsSample( accum[ pathIx ] ) )
+		{
+			return;
+		}
+		liveCnt++;
 
-SceneView SetupSideView()
-{
-	SceneView view;
+		wf.paths.throughput[ pathIx ] = 1.0;
 
-	view.targetSize = RenderSize;
-	view.camera = Camera(	vec4d( 0.0, 280.0, 0.0, 0.0 ),
-							vec4d( -1.0, 0.0, 0.0, 0.0 ),
-							vec4d( 0.0, 0.0, -1.0, 0.0 ),
-							vec4d( 0.0, 1.0, 0.0, 0.0 ),
-							CameraFov,
-							AspectRatio( view.targetSize ),
-							CameraNearPlane,
-							CameraFarPlane );
+		sample_t& sample = wf.paths.sample[ pathIx ];
+		sample.color = Color::Black;
+		sample.normal = vec3d( 0.0 );
+		sample.surfaceDot = 0.0;
+		sample.t = 0.0;
+		sample.hitCode = HIT_NONE;
 
-	view.viewTransform = view.camera.ToViewMatrix();
-	view.projTransform = view.camera.ToPerspectiveProjMatrix();
-	view.projView = view.projTransform * view.viewTransform;
+		const Ray ray = GetPixelRay( view, px, py, GetSubPixelOffset( pathIx, s ) );
 
-	return view;
+#if USE_AABB
+		double tnear = 0;
+		double tfar = 0;
+		if ( !scene.aabb.Intersect( ray, tnear, tfar ) )
+		{
+			return;
+		}
+#endif
+		queue.Push( ray, pathIx );
+	} );
+
+	return liveCnt;
 }
 
 
-void SetupViews()
+void ExtendStage( const rayQueue_t& queue, hitQueue_t<real_t>& hits )
 {
-	views[ VIEW_CAMERA ] = SetupFrontView();
-	views[ VIEW_FRONT ] = SetupFrontView();
-	views[ VIEW_TOP ] = SetupTopView();
-	views[ VIEW_SIDE ] = SetupSideView();
+	ParallelForQueue( queue.count, [&]( const uint32_t slot )
+	{
+		traceRay_t<real_t> tRay;
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			tRay.o[ i ] = static_cast<real_t>( queue.o[ i ][ slot ] );
+			tRay.d[ i ] = static_cast<real_t>( queue.d[ i ][ slot ] );
+			tRay.invD[ i ] = ( tRay.d[ i ] != real_t( 0 ) ) ? ( real_t( 1 ) / tRay.d[ i ] ) : std::numeric_limits<real_t>::max();
+		}
+
+		hit_t<real_t> hit;
+		hit.t = std::numeric_limits<real_t>::max();
+		hit.instanceIx = ResourceManager::InvalidModelIx;
+		TraceClosestHit( tRay, true, hit );
+
+		hits.t[ slot ] = hit.t;
+		hits.u[ slot ] = hit.u;
+		hits.v[ slot ] = hit.v;
+		hits.triIx[ slot ] = hit.triIx;
+		hits.instanceIx[ slot ] = hit.instanceIx;
+	} );
 }
 
 
-void TracePixel( const SceneView& view, Image<Color>& image, const uint32_t px, const uint32_t py )
+// Terminates paths that reach the sky, queues mirror bounces and emits shadow rays for everything else
+void ShadeStage( wavefront_t& wf, const uint32_t s, const uint32_t depth )
 {
-#if	USE_SSRAND
-	const uint32_t subSampleCnt = 100;
-	vec2d subPixelOffsets[ subSampleCnt ];
-	for( uint32_t ri = 0; ri < subSampleCnt; ++ri )
+	const rayQueue_t& queue = wf.rays[ 0 ];
+	rayQueue_t& bounceQueue = wf.rays[ 1 ];
+	bounceQueue.count = 0;
+	wf.shadows.groupCnt = 0;
+
+	const uint32_t lightCnt = ShadedLightCount();
+
+	ParallelForQueue( queue.count, [&]( const uint32_t slot )
 	{
-		subPixelOffsets[ ri ] = vec2d( Random(), Random() );
-	}
-#elif USE_SS4X
-	static const uint32_t subSampleCnt = 4;
-	static const vec2d subPixelOffsets[ subSampleCnt ] = { vec2d( 0.25, 0.25 ), vec2d( 0.75, 0.25 ), vec2d( 0.25, 0.75 ), vec2d( 0.75, 0.75 ) };
-#else
-	static const uint32_t subSampleCnt = 1;
-	static const vec2d subPixelOffsets[ subSampleCnt ] = { vec2d( 0.5, 0.5 ) };
-#endif
+		const uint32_t pathIx = queue.pathIx[ slot ];
+		const Ray ray = queue.GetRay( slot );
+		sample_t& pathSample = wf.paths.sample[ pathIx ];
 
-	Color pixelColor = Color::Black;
-	vec3d normal = vec3d( 0.0, 0.0, 0.0 );
-	double diffuse = 0.0; // Eye-to-Surface
-	double coverage = 0.0;
-	double t = 0.0;
+		if ( wf.hits.instanceIx[ slot ] == ResourceManager::InvalidModelIx )
+		{
+			const sample_t skySample = RecordSkyInfo( ray, DBL_MAX );
+			if ( depth == 0 )
+			{
+				pathSample = skySample;
+			}
+			pathSample.color = wf.paths.throughput[ pathIx ] * skySample.color;
+			return;
+		}
 
-	sample_t sample;
-	sample.hitCode = HIT_NONE;
+		hit_t<real_t> hit;
+		hit.t = wf.hits.t[ slot ];
+		hit.u = wf.hits.u[ slot ];
+		hit.v = wf.hits.v[ slot ];
+		hit.triIx = wf.hits.triIx[ slot ];
+		hit.instanceIx = wf.hits.instanceIx[ slot ];
 
-	for ( int32_t s = 0; s < subSampleCnt; ++s ) // Subsamples
-	{
-		vec2d pixelXY = vec2d( static_cast<double>( px ), static_cast<double>( py ) );
-		pixelXY += subPixelOffsets[ s ];
-		vec2d uv = vec2d( pixelXY[ 0 ] / ( view.targetSize[ 0 ] - 1.0 ), pixelXY[ 1 ] / ( view.targetSize[ 1 ] - 1.0 ) );
+		const sample_t surfaceSample = RecordSurfaceInfo( ray, hit );
+		if ( depth == 0 )
+		{
+			pathSample = surfaceSample;
+		}
+		else
+		{
+			pathSample.hitCnt++;
+		}
 
-		Ray ray = view.camera.GetViewRay( uv );
+		const material_t& material = *rm.GetMaterialRef( surfaceSample.materialId );
+		const Color surfaceColor = material.textured ? surfaceSample.albedo : surfaceSample.color;
 
-		//////////////////////////////////////////////////////////////////////////////////////////////////////
-		// Experimental
-		const vec3d up = vec3d( 0.0, 0.0, 1.0 );
-		const vec3d z = ray.GetVector();
-		const vec3d x = Cross( up, z );
-		const vec3d y = Cross( x, z );
+		const sampler_t sampler = MakeSampler( PixelSampler, pathIx, s );
 
-		float e0, e1;
-		RandomPointOnCircle( e0, e1 );
-		const vec4d r = vec4d( e0, e1, 0.0, 0.0 );
-		
-		const mat4x4d m = CreateMatrix4x4(	x[ 0 ], x[ 1 ], x[ 2 ], 0.0,
-											y[ 0 ], y[ 1 ], y[ 2 ], 0.0,
-											z[ 0 ], z[ 1 ], z[ 2 ], 0.0,
-											0.0,	0.0,	0.0,	1.0 );
+#if USE_RELFECTION
+		if ( ( depth < MaxBounces ) && ( material.Tr > 0.0 ) )
+		{
+			wf.paths.throughput[ pathIx ] *= material.Tr;
+			pathSample.color = Color::Black;
 
-		const vec4d perturb = m * r;
+			const Ray reflectionRay = MakeReflectionRay<real_t>( ray, surfaceSample, sampler, depth );
+#if USE_AABB
+			double tnear = 0;
+			double tfar = 0;
+			if ( !scene.aabb.Intersect( reflectionRay, tnear, tfar ) )
+			{
+				return;
+			}
+#endif
+			bounceQueue.Push( reflectionRay, pathIx );
+			return;
+		}
+#endif
 
-		//ray.d = ray.d + Trunc<4,1>( 0.01 * perturb );
-		//assert( ( Dot( x, z ) < 1e6 ) && ( Dot( x, y ) < 1e6 ) && ( Dot( y, z ) < 1e6 ) );
-		//////////////////////////////////////////////////////////////////////////////////////////////////////
+		const vec3d viewVector = ray.GetVector().Reverse().Normalize();
 
-		sample = RayTrace_r( ray, 0 );
-		pixelColor += sample.color;
-		diffuse += sample.surfaceDot;
-		normal += sample.normal;
-		t += sample.t;
-		coverage += sample.hitCode != HIT_NONE ? 1.0 : 0.0;
-	}
+		shadowQueue_t& shadows = wf.shadows;
+		const uint32_t group = shadows.groupCnt++;
+		shadows.pathIx[ group ] = pathIx;
+		shadows.ambient[ group ] = AmbientLight * ( Color( material.Ka ) * surfaceColor );
 
-	if ( coverage > 0.0 )
-	{
-		int32_t imageX = static_cast<int32_t>( px );
-		int32_t imageY = static_cast<int32_t>( py );
+		lightSample_t selected[ MaxShadedLights ];
+		SelectLights( sampler, depth, selected );
+		for ( uint32_t si = 0; si < lightCnt; ++si )
+		{
+			const uint32_t entry = group * lightCnt + si;
+			const light_t& L = scene.lights[ selected[ si ].lightIx ];
+			const Ray shadowRay = MakeShadowRay<real_t>( surfaceSample, L );
+			for ( int32_t i = 0; i < 3; ++i )
+			{
+				shadows.o[ i ][ entry ] = shadowRay.o[ i ];
+			}
+			shadows.lightIx[ entry ] = selected[ si ].lightIx;
+			shadows.contribution[ entry ] = selected[ si ].weight * ShadeLight( surfaceSample, material, surfaceColor, viewVector, L, shadowRay );
+		}
+	} );
+}
 
-		coverage /= subSampleCnt;
-		diffuse /= subSampleCnt;
-		normal = normal.Normalize();
-		t /= subSampleCnt;
 
-		Color src = Color( LinearToSrgb( ( 1.0f / subSampleCnt ) * pixelColor ) );
-		src.rgba().a = (float)coverage;
+// Any-hit tests for every queued shadow ray, then each path sums its visible lights in selection order
+void ShadowStage( wavefront_t& wf )
+{
+	shadowQueue_t& shadows = wf.shadows;
+	const uint32_t lightCnt = ShadedLightCount();
+	const uint32_t groupCnt = shadows.groupCnt;
 
-		// normal = normal.Reverse();
-		Color normColor = Vec4dToColor( vec4d( 0.5 * normal + vec3d( 0.5 ), 1.0 ) );
-		dbg.diffuse.SetPixel( imageX, imageY, Color( (float)-diffuse ).AsR8G8B8A8() );
-		dbg.normal.SetPixel( imageX, imageY, normColor.AsR8G8B8A8() );
+	ParallelForQueue( groupCnt * lightCnt, [&]( const uint32_t entry )
+	{
+#if USE_SHADOWS
+		const uint32_t li = shadows.lightIx[ entry ];
+		const vec3d origin = vec3d( shadows.o[ 0 ][ entry ], shadows.o[ 1 ][ entry ], shadows.o[ 2 ][ entry ] );
+		shadows.visible[ entry ] = OccludedScene<real_t>( Ray( origin, scene.lights[ li ].pos ), li ) ? 0 : 1;
+#else
+		shadows.visible[ entry ] = 1;
+#endif
+	} );
 
-		Color dest = Color( image.GetPixel( imageX, imageY ) );
+	ParallelForQueue( groupCnt, [&]( const uint32_t group )
+	{
+		Color finalColor = Color::Black;
+		for ( uint32_t li = 0; li < lightCnt; ++li )
+		{
+			const uint32_t entry = group * lightCnt + li;
+			finalColor += shadows.visible[ entry ] ? shadows.contribution[ entry ] : Color::Black;
+		}
 
-		Color pixel = BlendColor( src, dest, blendMode_t::SRCALPHA );
-		image.SetPixel( imageX, imageY, pixel );
-	}
+		const uint32_t pathIx = shadows.pathIx[ group ];
+		wf.paths.sample[ pathIx ].color = wf.paths.throughput[ pathIx ] * ( finalColor + shadows.ambient[ group ] );
+	} );
 }
 
 
-void TracePatch( const SceneView& view, Image<Color>* image, const vec2i& p0, const vec2i& p1 )
+// Queue-based alternative to TracePatch/RayTrace_r. Each subsample is one wave over the whole image,
+// and every stage runs over its full queue before the next stage starts.
+void TraceSceneWavefront( const SceneView& view, Image<Color>& image )
 {
-	const int32_t x0 = p0[ 0 ];
-	const int32_t y0 = p0[ 1 ];
-	const int32_t x1 = p1[ 0 ];
-	const int32_t y1 = p1[ 1 ];
-
-	for ( uint32_t py = y0; py < y1; ++py )
+	wavefront_t wf;
+	wf.width = std::min( static_cast<uint32_t>( view.targetSize[ 0 ] ), image.GetWidth() );
+	wf.height = std::min( static_cast<uint32_t>( view.targetSize[ 1 ] ), image.GetHeight() );
+
+	const uint32_t pathCnt = wf.width * wf.height;
+	wf.paths.Resize( pathCnt );
+	wf.rays[ 0 ].Reserve( pathCnt );
+	wf.rays[ 1 ].Reserve( pathCnt );
+	wf.hits.Reserve( pathCnt );
+	wf.shadows.Reserve( pathCnt, ShadedLightCount() );
+
+	std::vector<pixelAccum_t> accum( pathCnt );
+	for ( uint32_t pixelIx = 0; pixelIx < pathCnt; ++pixelIx )
 	{
-		if( py >= image->GetHeight() )
-			return;
+		ClearPixelAccum( accum[ pixelIx ] );
+	}
 
-		for ( uint32_t px = x0; px < x1; ++px )
+	for ( uint32_t s = 0; s < SubSampleCnt; ++s )
+	{
+		if ( GenerateStage( view, wf, accum, s ) == 0 )
 		{
-			if ( px >= image->GetWidth() )
-				return;
+			break;
+		}
 
-			TracePixel( view, *image, px, py );
+		for ( uint32_t depth = 0; wf.rays[ 0 ].count > 0; ++depth )
+		{
+			ExtendStage( wf.rays[ 0 ], wf.hits );
+			ShadeStage( wf, s, depth );
+			ShadowStage( wf );
+
+			// Bounce: reflection rays were compacted into the second queue as they were shaded
+			std::swap( wf.rays[ 0 ].o, wf.rays[ 1 ].o );
+			std::swap( wf.rays[ 0 ].d, wf.rays[ 1 ].d );
+			std::swap( wf.rays[ 0 ].pathIx, wf.rays[ 1 ].pathIx );
+			wf.rays[ 0 ].count = wf.rays[ 1 ].count.load();
 		}
+
+		// Pixels that took no subsample this wave still need none, since their accumulators are unchanged
+		ParallelForQueue( pathCnt, [&]( const uint32_t pathIx )
+		{
+			if ( NeedsSample( accum[ pathIx ] ) )
+			{
+				AccumulateSample( accum[ pathIx ], wf.paths.sample[ pathIx ] );
+			}
+		} );
+		std::cout << ( 100 * ( s + 1 ) ) / SubSampleCnt << "% ";
+	}
+
+#if USE_ADAPTIVE
+	for ( const pixelAccum_t& pixelAccum : accum )
+	{
+		adaptiveSampleCnt += pixelAccum.sampleCnt;
 	}
+#endif
+
+	ResolveImage( view, image, wf.width, wf.height, [&]( const uint32_t px, const uint32_t py ) -> const pixelAccum_t&
+	{
+		return accum[ py * wf.width + px ];
+	} );
 }
+#endif
 
 
-void TraceScene( const SceneView& view, Image<Color>& image )
+void TraceScene( const SceneView& view, Image<Color>& image, const uint32_t tileSize = TileSize )
 {
-#if USE_RAYTRACE
+#if USE_RAYTRACE && USE_PROGRESSIVE
+	TraceSceneProgressive( view, image, tileSize );
+#elif USE_RAYTRACE && USE_WAVEFRONT
+	TraceSceneWavefront( view, image );
+#elif USE_RAYTRACE
+	assert( tileSize <= TileSize );
 
-	uint32_t threadsLaunched = 0;
-	uint32_t threadsComplete = 0;
-	std::vector<std::thread> threads;
+	const uint32_t renderWidth = std::min( static_cast<uint32_t>( view.targetSize[ 0 ] ), image.GetWidth() );
+	const uint32_t renderHeight = std::min( static_cast<uint32_t>( view.targetSize[ 1 ] ), image.GetHeight() );
 
-	uint32_t renderWidth = view.targetSize[ 0 ];
-	uint32_t renderHeight = view.targetSize[ 1 ];
+	const uint32_t tilesX = ( renderWidth + tileSize - 1 ) / tileSize;
+	const uint32_t tilesY = ( renderHeight + tileSize - 1 ) / tileSize;
 
-	const uint32_t patchSize = 120;
-	for ( uint32_t py = 0; py < renderHeight; py += patchSize )
+	std::vector<tileBuffer_t, AlignedAllocator<tileBuffer_t>> tiles( tilesX * tilesY );
+
+	uint32_t lastPercent = ~0u;
+	threadPool.ParallelFor( tilesX * tilesY, [&]( const uint32_t tileIx, const uint32_t workerIx )
 	{
-		for ( uint32_t px = 0; px < renderWidth; px += patchSize )
-		{
-			vec2i patch;
-			patch[ 0 ] = Clamp( px + patchSize, px, renderWidth );
-			patch[ 1 ] = Clamp( py + patchSize, py, renderHeight );
+		const uint32_t px = ( tileIx % tilesX ) * tileSize;
+		const uint32_t py = ( tileIx / tilesX ) * tileSize;
+
+		tileBuffer_t& tile = tiles[ tileIx ];
+		tile.p0 = vec2i( px, py );
+		tile.p1[ 0 ] = Clamp( px + tileSize, px, renderWidth );
+		tile.p1[ 1 ] = Clamp( py + tileSize, py, renderHeight );
 
-			threads.push_back( std::thread( TracePatch, view, &image, vec2i( px, py ), patch ) );
-			++threadsLaunched;
+		TracePatch( view, tile );
+	},
+	[&]( const uint32_t tilesDone, const uint32_t tileCnt )
+	{
+		const uint32_t percent = static_cast<uint32_t>( 100.0 * ( tilesDone / (double)tileCnt ) );
+		if ( percent != lastPercent )
+		{
+			std::cout << percent << "% ";
+			lastPercent = percent;
 		}
-	}
+	} );
 
-	for ( auto& thread : threads )
+#if USE_DENOISE
+	DenoiseResolved( renderWidth, renderHeight, [&]( const uint32_t px, const uint32_t py ) -> resolvedPixel_t&
 	{
-		thread.join(); // TODO: replace with non-blocking call for better messaging
-		++threadsComplete;
-		std::cout << static_cast<int>( 100.0 * ( threadsComplete / (double)threadsLaunched ) ) << "% ";
-	}
+		return tiles[ ( py / tileSize ) * tilesX + ( px / tileSize ) ].At( px, py );
+	} );
+#endif
+
+	// Blit the tiles, one task per row of tiles so each task owns whole image rows
+	threadPool.ParallelFor( tilesY, [&]( const uint32_t tileY, const uint32_t workerIx )
+	{
+		for ( uint32_t tileX = 0; tileX < tilesX; ++tileX )
+		{
+			CommitTile( image, tiles[ tileY * tilesX + tileX ] );
+		}
+	} );
 #endif
 }
 
@@ -536,6 +1830,47 @@ mat4x4d GetModelToWorldAxis( const axisMode_t mode )
 }
 
 
+// Determinant of the upper 3x3 of an affine matrix; negative when it mirrors
+double Det3x3( const mat4x4d& m )
+{
+	return	m[ 0 ][ 0 ] * ( m[ 1 ][ 1 ] * m[ 2 ][ 2 ] - m[ 1 ][ 2 ] * m[ 2 ][ 1 ] ) -
+			m[ 0 ][ 1 ] * ( m[ 1 ][ 0 ] * m[ 2 ][ 2 ] - m[ 1 ][ 2 ] * m[ 2 ][ 0 ] ) +
+			m[ 0 ][ 2 ] * ( m[ 1 ][ 0 ] * m[ 2 ][ 1 ] - m[ 1 ][ 1 ] * m[ 2 ][ 0 ] );
+}
+
+
+// Inverse of a rotation, scale and translation matrix
+mat4x4d AffineInverse( const mat4x4d& m )
+{
+	const double c00 = m[ 1 ][ 1 ] * m[ 2 ][ 2 ] - m[ 1 ][ 2 ] * m[ 2 ][ 1 ];
+	const double c01 = m[ 0 ][ 2 ] * m[ 2 ][ 1 ] - m[ 0 ][ 1 ] * m[ 2 ][ 2 ];
+	const double c02 = m[ 0 ][ 1 ] * m[ 1 ][ 2 ] - m[ 0 ][ 2 ] * m[ 1 ][ 1 ];
+	const double c10 = m[ 1 ][ 2 ] * m[ 2 ][ 0 ] - m[ 1 ][ 0 ] * m[ 2 ][ 2 ];
+	const double c11 = m[ 0 ][ 0 ] * m[ 2 ][ 2 ] - m[ 0 ][ 2 ] * m[ 2 ][ 0 ];
+	const double c12 = m[ 0 ][ 2 ] * m[ 1 ][ 0 ] - m[ 0 ][ 0 ] * m[ 1 ][ 2 ];
+	const double c20 = m[ 1 ][ 0 ] * m[ 2 ][ 1 ] - m[ 1 ][ 1 ] * m[ 2 ][ 0 ];
+	const double c21 = m[ 0 ][ 1 ] * m[ 2 ][ 0 ] - m[ 0 ][ 0 ] * m[ 2 ][ 1 ];
+	const double c22 = m[ 0 ][ 0 ] * m[ 1 ][ 1 ] - m[ 0 ][ 1 ] * m[ 1 ][ 0 ];
+
+	const double invDet = 1.0 / Det3x3( m );
+
+	const double r[ 3 ][ 3 ] = {	{ c00 * invDet, c01 * invDet, c02 * invDet },
+									{ c10 * invDet, c11 * invDet, c12 * invDet },
+									{ c20 * invDet, c21 * invDet, c22 * invDet } };
+
+	double t[ 3 ];
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		t[ i ] = -( r[ i ][ 0 ] * m[ 0 ][ 3 ] + r[ i ][ 1 ] * m[ 1 ][ 3 ] + r[ i ][ 2 ] * m[ 2 ][ 3 ] );
+	}
+
+	return CreateMatrix4x4(	r[ 0 ][ 0 ],	r[ 0 ][ 1 ],	r[ 0 ][ 2 ],	t[ 0 ],
+							r[ 1 ][ 0 ],	r[ 1 ][ 1 ],	r[ 1 ][ 2 ],	t[ 1 ],
+							r[ 2 ][ 0 ],	r[ 2 ][ 1 ],	r[ 2 ][ 2 ],	t[ 2 ],
+							0.0,			0.0,			0.0,			1.0 );
+}
+
+
 mat4x4d BuildModelMatrix( const vec3d& origin, const vec3d& degressZYZ, const double scale, const axisMode_t mode )
 {
 	const mat4x4d axis = GetModelToWorldAxis( mode );
@@ -591,9 +1926,112 @@ void CreateMaterials( ResourceManager& rm )
 	mirrorMaterial.Ke = Color( 1.0f ).AsRGBf();
 	mirrorMaterial.Tr = 0.8f;
 	rm.StoreMaterialCopy( mirrorMaterial );
+
+	// sphere.mtl, the material of the mesh the demo spheres replaced
+	material_t sphereMaterial;
+	memset( &sphereMaterial, 0, sizeof( material_t ) );
+	sphereMaterial.Ka = Color( 0.0f ).AsRGBf();
+	sphereMaterial.Kd = Color( 0.8824f, 0.7765f, 0.3412f ).AsRGBf();
+	sphereMaterial.Ks = Color( 0.35f ).AsRGBf();
+	sphereMaterial.Ke = Color( 0.0f ).AsRGBf();
+	sphereMaterial.Ns = 32.0;
+	sphereMaterial.Tr = 0.0f;
+	rm.StoreMaterialCopy( sphereMaterial );
+}
+
+
+// Source of each entry in scene.models, kept until BuildMeshes creates them
+static std::vector<std::pair<uint32_t, bool>> meshSources;
+
+
+// Places a model in the scene. Every instance of a model with the same smoothing shares one object-space mesh.
+// The mesh itself is created later by BuildMeshes, along with every other mesh. winding is the model's front face vertex order,
+// which model files do not record, so every caller states it.
+void AddInstance( const uint32_t modelIx, const mat4x4d& modelMatrix, const bool smooth, const windingOrder_t winding, const Color& color, const matHdl_t materialId = InvalidMaterialHdl )
+{
+	static std::map<std::pair<uint32_t, bool>, uint32_t> meshLookup;
+
+	const std::pair<uint32_t, bool> meshKey = std::make_pair( modelIx, smooth );
+	auto it = meshLookup.find( meshKey );
+	if ( it == meshLookup.end() )
+	{
+		scene.models.push_back( ModelInstance() );
+		meshSources.push_back( meshKey );
+		it = meshLookup.insert( std::make_pair( meshKey, static_cast<uint32_t>( scene.models.size() - 1 ) ) ).first;
+	}
+
+	instance_t instance;
+	instance.transform = modelMatrix;
+	instance.invTransform = AffineInverse( modelMatrix );
+	instance.meshIx = it->second;
+	instance.color = color;
+	instance.materialId = materialId;
+
+	instance.winding = winding;
+	if ( Det3x3( modelMatrix ) < 0.0 )
+	{
+		instance.winding = ( winding == WINDING_CCW ) ? WINDING_CW : WINDING_CCW;
+	}
+	scene.instances.push_back( instance );
+}
+
+
+// Creates the object-space meshes queued by AddInstance. CreateModelInstance takes the shared
+// ResourceManager by mutable reference and makes no thread-safety promise, so it runs on this
+// thread. It also builds the mesh's octree, which nothing here reads since tracing moved to the
+// BVH, but it has no option to skip it. Only the BLAS and SoA work in BuildBottomLevel runs on
+// the pool.
+void BuildMeshes()
+{
+	const mat4x4d identity = CreateMatrix4x4(	1.0, 0.0, 0.0, 0.0,
+												0.0, 1.0, 0.0, 0.0,
+												0.0, 0.0, 1.0, 0.0,
+												0.0, 0.0, 0.0, 1.0 );
+
+	for ( size_t meshIx = 0; meshIx < meshSources.size(); ++meshIx )
+	{
+		CreateModelInstance( rm, meshSources[ meshIx ].first, identity, meshSources[ meshIx ].second, Color::White, &scene.models[ meshIx ] );
+	}
+	meshSources.clear();
+}
+
+
+// Meshes big enough to split are built one at a time across the whole pool. The rest are built
+// together, one task per mesh.
+void BuildBottomLevel()
+{
+	const uint32_t meshCnt = static_cast<uint32_t>( scene.models.size() );
+	scene.blas.resize( meshCnt );
+	scene.triSoA.resize( meshCnt );
+
+	std::vector<uint32_t> smallMeshes;
+	for ( uint32_t m = 0; m < meshCnt; ++m )
+	{
+		const ModelInstance& mesh = scene.models[ m ];
+		if ( mesh.triCache.size() < BvhParallelMinPrims )
+		{
+			smallMeshes.push_back( m );
+			continue;
+		}
+		BuildTriangleBVH( mesh.triCache, scene.blas[ m ], &threadPool );
+		BuildTriangleSoA( mesh.triCache, scene.blas[ m ], scene.triSoA[ m ] );
+	}
+
+	threadPool.ParallelFor( static_cast<uint32_t>( smallMeshes.size() ), [&]( const uint32_t i, const uint32_t workerIx )
+	{
+		const uint32_t m = smallMeshes[ i ];
+		BuildTriangleBVH( scene.models[ m ].triCache, scene.blas[ m ] );
+		BuildTriangleSoA( scene.models[ m ].triCache, scene.blas[ m ], scene.triSoA[ m ] );
+	} );
 }
 
 
+// Where the sphere.mdl mesh sat when placed at scale 0.5: its bounds center lies this far from
+// each placement point and its half extent is the radius
+static const vec3d	DemoSphereOffset	= vec3d( -13.7885, -13.0798, 10.0674 );
+static const double	DemoSphereRadius	= 21.689;
+
+
 void BuildScene()
 {
 	uint32_t modelIx;
@@ -605,63 +2043,39 @@ void BuildScene()
 	if ( modelIx >= 0 )
 	{
 		mat4x4d modelMatrix;
+
+		// Counter-clockwise: the faces of teapot.obj enclose a positive signed volume
+		const windingOrder_t winding = WINDING_CCW;
 		
-		ModelInstance teapot0;
 		modelMatrix = BuildModelMatrix( vec3d( 30.0, 120.0, 10.0 ), vec3d( 0.0, 0.0, -90.0 ), 1.0, RHS_XZY );
-		CreateModelInstance( modelIx, modelMatrix, true, Color::Yellow, &teapot0, colorMaterialId );
-		scene.models.push_back( teapot0 );
+		AddInstance( modelIx, modelMatrix, true, winding, Color::Yellow, colorMaterialId );
 		
-		ModelInstance teapot1;
 		modelMatrix = BuildModelMatrix( vec3d( -30.0, -50.0, 10.0 ), vec3d( 0.0, 0.0, 30.0 ), 1.0, RHS_XZY );
-		CreateModelInstance( modelIx, modelMatrix, true, Color::Green, &teapot1, colorMaterialId );
-		scene.models.push_back( teapot1 );
+		AddInstance( modelIx, modelMatrix, true, winding, Color::Green, colorMaterialId );
 	}
 	*/
 
 	rm.PushVB( vb );
 	rm.PushIB( ib );
 
-	modelIx = LoadModelBin( std::string( "models/sphere.mdl" ), rm );
-	if( modelIx >= 0 )
-	{
-		mat4x4d modelMatrix;
-
-		ModelInstance sphere0;
-		modelMatrix = BuildModelMatrix( vec3d( 30.0, -70.0, 0.0 ), vec3d( 0.0, 0.0, 0.0 ), 0.5, RHS_XZY );
-		CreateModelInstance( rm, modelIx, modelMatrix, true, Color::White, &sphere0, mirrorMaterialId );
-		scene.models.push_back( sphere0 );
-
-		ModelInstance sphere1;
-		modelMatrix = BuildModelMatrix( vec3d( 30.0, -20.0, 0.0 ), vec3d( 0.0, 0.0, 0.0 ), 0.5, RHS_XZY );
-		CreateModelInstance( rm, modelIx, modelMatrix, true, Color::Red, &sphere1 );
-		scene.models.push_back( sphere1 );
+	scene.primitives.push_back( MakeSphere( vec3d( 30.0, -70.0, 0.0 ) + DemoSphereOffset, DemoSphereRadius, Color::White, mirrorMaterialId ) );
+	scene.primitives.push_back( MakeSphere( vec3d( 30.0, -20.0, 0.0 ) + DemoSphereOffset, DemoSphereRadius, Color::Red, sphereMaterialId ) );
+	scene.primitives.push_back( MakeSphere( vec3d( 30.0, 30.0, 0.0 ) + DemoSphereOffset, DemoSphereRadius, Color::White, mirrorMaterialId ) );
+	scene.primitives.push_back( MakeSphere( vec3d( 30.0, 80.0, 0.0 ) + DemoSphereOffset, DemoSphereRadius, Color::White, mirrorMaterialId ) );
 
-		ModelInstance sphere2;
-		modelMatrix = BuildModelMatrix( vec3d( 30.0, 30.0, 0.0 ), vec3d( 0.0, 0.0, 0.0 ), 0.5, RHS_XZY );
-		CreateModelInstance( rm, modelIx, modelMatrix, true, Color::White, &sphere2, mirrorMaterialId );
-		scene.models.push_back( sphere2 );
-
-		ModelInstance sphere3;
-		modelMatrix = BuildModelMatrix( vec3d( 30.0, 80.0, 0.0 ), vec3d( 0.0, 0.0, 0.0 ), 0.5, RHS_XZY );
-		CreateModelInstance( rm, modelIx, modelMatrix, true, Color::White, &sphere3, mirrorMaterialId );
-		scene.models.push_back( sphere3 );
-	}
-
-	
 	modelIx = LoadModelBin( std::string( "models/12140_Skull_v3_L2.mdl" ), rm );
 	if ( modelIx >= 0 )
 	{
 		mat4x4d modelMatrix;
 
-		ModelInstance skull0;
+		// Unverified; the skull's source mesh is not in models/ to measure
+		const windingOrder_t winding = WINDING_CCW;
+
 		modelMatrix = BuildModelMatrix( vec3d( 30.0, 120.0, 10.0 ), vec3d( 0.0, 90.0, 40.0 ), 4.0, RHS_XZY );
-		CreateModelInstance( rm, modelIx, modelMatrix, true, Color::Gold, &skull0 );
-		scene.models.push_back( skull0 );
+		AddInstance( modelIx, modelMatrix, true, winding, Color::Gold );
 
-		ModelInstance skull1;
 		modelMatrix = BuildModelMatrix( vec3d( -30.0, -120.0, -10.0 ), vec3d( 0.0, 90.0, 0.0 ), 5.0, RHS_XZY );
-		CreateModelInstance( rm, modelIx, modelMatrix, true, Color::Gold, &skull1 );
-		scene.models.push_back( skull1 );
+		AddInstance( modelIx, modelMatrix, true, winding, Color::Gold );
 	}
 	
 
@@ -671,23 +2085,15 @@ void BuildScene()
 	{
 		mat4x4d modelMatrix;
 
-		ModelInstance car0;
+		// Unverified; the car's source mesh is not in models/ to measure
+		const windingOrder_t winding = WINDING_CCW;
+
 		modelMatrix = BuildModelMatrix( vec3d( -30.0, -100.0, -10.0 ), vec3d( 0.0, 0.0, 0.0 ), 6.0, RHS_XZY );
-		CreateModelInstance( rm, modelIx, modelMatrix, true, Color::White, &car0 );
-		scene.models.push_back( car0 );
+		AddInstance( modelIx, modelMatrix, true, winding, Color::White );
 	}
 	*/
 
-	modelIx = CreatePlaneModel( rm, vec2d( 500.0 ), vec2i( 1 ), colorMaterialId );
-	if ( modelIx >= 0 )
-	{
-		mat4x4d modelMatrix;
-
-		ModelInstance plane0;
-		modelMatrix = BuildModelMatrix( vec3d( 0.0, 0.0, -10.0 ), vec3d( 0.0, 0.0, 0.0 ), 1.0, RHS_XYZ );
-		CreateModelInstance( rm, modelIx, modelMatrix, false, Color::DGrey, &plane0, colorMaterialId );
-		scene.models.push_back( plane0 );
-	}
+	scene.primitives.push_back( MakePlane( vec3d( 0.0, 0.0, -10.0 ), vec3d( 0.0, 0.0, 1.0 ), vec3d( 1.0, 0.0, 0.0 ), vec2d( 250.0 ), Color::DGrey, colorMaterialId ) );
 
 	scene.lights.reserve( 3 );
 	{
@@ -706,12 +2112,57 @@ void BuildScene()
 		*/
 	}
 
-	const size_t modelCnt = scene.models.size();
-	for ( size_t m = 0; m < modelCnt; ++m )
+	BuildMeshes();
+	BuildBottomLevel();
+
+	const uint32_t instanceCnt = static_cast<uint32_t>( scene.instances.size() );
+	std::vector<AABB> instanceBounds( instanceCnt + scene.primitives.size() );
+	for ( uint32_t i = 0; i < instanceCnt; ++i )
+	{
+		instance_t& instance = scene.instances[ i ];
+
+		// Bound the placed corners of the shared BLAS root, so the cost doesn't grow with the mesh
+		const AABB meshBounds = scene.blas[ instance.meshIx ].GetAABB();
+		for ( int32_t corner = 0; corner < 8; ++corner )
+		{
+			const vec4d pt = vec4d(	( corner & 1 ) ? meshBounds.max[ 0 ] : meshBounds.min[ 0 ],
+									( corner & 2 ) ? meshBounds.max[ 1 ] : meshBounds.min[ 1 ],
+									( corner & 4 ) ? meshBounds.max[ 2 ] : meshBounds.min[ 2 ],
+									1.0 );
+			instance.bounds.Expand( Trunc<4, 1>( instance.transform * pt ) );
+		}
+		instanceBounds[ i ] = instance.bounds;
+	}
+
+	for ( const instance_t& instance : scene.instances )
+	{
+		scene.aabb.Expand( instance.bounds.min );
+		scene.aabb.Expand( instance.bounds.max );
+	}
+
+	for ( size_t p = 0; p < scene.primitives.size(); ++p )
+	{
+		scene.primitiveFirstTri.push_back( static_cast<uint32_t>( scene.primitiveTris.size() ) );
+		TessellatePrimitive( scene.primitives[ p ], scene.primitiveTris );
+
+		const AABB bounds = PrimitiveBounds( scene.primitives[ p ] );
+		instanceBounds[ instanceCnt + p ] = bounds;
+		scene.aabb.Expand( bounds.min );
+		scene.aabb.Expand( bounds.max );
+	}
+	scene.primitiveFirstTri.push_back( static_cast<uint32_t>( scene.primitiveTris.size() ) );
+	scene.tlas.Build( instanceBounds, 1 );
+
+	if ( scene.lights.size() > ExhaustiveLightCnt )
 	{
-		ModelInstance& model = scene.models[ m ];
-		scene.aabb.Expand( model.octree.GetAABB().min );
-		scene.aabb.Expand( model.octree.GetAABB().max );
+		std::vector<vec3d> lightPositions;
+		std::vector<double> lightPowers;
+		for ( const light_t& light : scene.lights )
+		{
+			lightPositions.push_back( light.pos );
+			lightPowers.push_back( 0.2126 * light.intensity[ 0 ] + 0.7152 * light.intensity[ 1 ] + 0.0722 * light.intensity[ 2 ] );
+		}
+		scene.lightTree.Build( lightPositions, lightPowers );
 	}
 }
 
@@ -774,14 +2225,43 @@ int main(void)
 
 	std::cout << "Load Time: " << loadTimer.GetElapsed() << "ms" << std::endl;
 
-	dbg.diffuse = Image<Color>( RenderWidth, RenderHeight, Color::Red, "dbgDiffuse" );
-	dbg.normal = Image<Color>( RenderWidth, RenderHeight, Color::White, "dbgNormal" );
+	if ( AovChannels & AOV_FACING )
+	{
+		dbg.diffuse = Image<Color>( RenderWidth, RenderHeight, Color::Red, "dbgDiffuse" );
+	}
+	if ( AovChannels & AOV_NORMAL )
+	{
+		dbg.normal = Image<Color>( RenderWidth, RenderHeight, Color::White, "dbgNormal" );
+	}
+	if ( AovChannels & AOV_ALBEDO )
+	{
+		dbg.albedo = Image<Color>( RenderWidth, RenderHeight, Color::Black, "aovAlbedo" );
+	}
+	if ( AovChannels & AOV_DEPTH )
+	{
+		depthBuffer = Image<float>( RenderWidth, RenderHeight, 0.0f, "depthBuffer" );
+	}
+	if ( AovChannels & AOV_INSTANCE )
+	{
+		dbg.instanceId = Image<Color>( RenderWidth, RenderHeight, Color::Black, "aovInstanceId" );
+	}
+	if ( AovChannels & AOV_MATERIAL )
+	{
+		dbg.materialId = Image<Color>( RenderWidth, RenderHeight, Color::Black, "aovMaterialId" );
+	}
+	if ( AovChannels & AOV_HITCOUNT )
+	{
+		dbg.hitCount = Image<Color>( RenderWidth, RenderHeight, Color::Black, "aovHitCount" );
+	}
+	if ( AovChannels & AOV_MOTION )
+	{
+		dbg.motion = Image<Color>( RenderWidth, RenderHeight, Color::Black, "aovMotion" );
+	}
 	dbg.wireframe = Image<Color>( RenderWidth, RenderHeight, Color::LGrey, "dbgWireframe" );
 	dbg.topWire = Image<Color>( RenderWidth, RenderHeight, Color::LGrey, "dbgTopWire" );
 	dbg.sideWire = Image<Color>( RenderWidth, RenderHeight, Color::LGrey, "dbgSideWire" );
 
 	colorBuffer = Image<Color>( RenderWidth, RenderHeight, Color::Black, "colorBuffer" );
-	depthBuffer = Image<float>( RenderWidth, RenderHeight, 0.0f, "depthBuffer" );
 
 	Image<Color> frameBuffer = Image<Color>( RenderWidth, RenderHeight, Color::DGrey, "_frameBuffer" );
 	DrawGradientImage( frameBuffer, Color::Blue, Color::Red, 0.8f );
@@ -796,19 +2276,53 @@ int main(void)
 		traceTimer.Start();
 		TraceScene( views[ VIEW_CAMERA ], frameBuffer );
 		traceTimer.Stop();
+		views[ VIEW_CAMERA ].prevProjView = views[ VIEW_CAMERA ].projView;
 
 		RastizeViews();
 
 		std::cout << "\n\nTrace Time: " << traceTimer.GetElapsed() << "ms" << std::endl;
+#if USE_ADAPTIVE
+		std::cout << "Samples/Pixel: " << adaptiveSampleCnt / static_cast<double>( RenderWidth * RenderHeight ) << std::endl;
+		adaptiveSampleCnt = 0;
+#endif
 
 		WriteImage( frameBuffer, "output", i );
 	}
 
-	WriteImage( dbg.diffuse, "output" );
-	WriteImage( dbg.normal, "output" );
+	if ( AovChannels & AOV_FACING )
+	{
+		WriteImage( dbg.diffuse, "output" );
+	}
+	if ( AovChannels & AOV_NORMAL )
+	{
+		WriteImage( dbg.normal, "output" );
+	}
+	if ( AovChannels & AOV_ALBEDO )
+	{
+		WriteImage( dbg.albedo, "output" );
+	}
+	if ( AovChannels & AOV_DEPTH )
+	{
+		WriteImage( depthBuffer, "output" );
+	}
+	if ( AovChannels & AOV_INSTANCE )
+	{
+		WriteImage( dbg.instanceId, "output" );
+	}
+	if ( AovChannels & AOV_MATERIAL )
+	{
+		WriteImage( dbg.materialId, "output" );
+	}
+	if ( AovChannels & AOV_HITCOUNT )
+	{
+		WriteImage( dbg.hitCount, "output" );
+	}
+	if ( AovChannels & AOV_MOTION )
+	{
+		WriteImage( dbg.motion, "output" );
+	}
 
 	WriteImage( colorBuffer, "output" );
-	WriteImage( depthBuffer, "output" );
 
 	WriteImage( dbg.wireframe, "output" );
 	WriteImage( dbg.topWire, "output" );
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <float.h>
+#include <limits>
+#include "../GfxCore/geom.h"
+#include "alignedAllocator.h"
+#include "intersect.h"
+
+// Structure-of-arrays ray packet. Lane loops below are written without branches so the
+// compiler can map them onto vector registers.
+template<uint32_t N, typename T>
+struct alignas( CacheLineSize ) rayPacket_t
+{
+	T			o[ 3 ][ N ];
+	T			d[ 3 ][ N ];
+	T			invD[ 3 ][ N ];
+};
+
+
+template<uint32_t N, typename T>
+struct alignas( CacheLineSize ) packetHit_t
+{
+	T			t[ N ];		// Doubles as the per-lane tMax during traversal
+	T			u[ N ];
+	T			v[ N ];
+	uint32_t	triIx[ N ];
+	uint32_t	instanceIx[ N ];
+};
+
+
+template<uint32_t N, typename T>
+inline void SetPacketRay( rayPacket_t<N, T>& packet, const uint32_t lane, const Ray& ray )
+{
+	const traceRay_t<T> tRay = MakeTraceRay<T>( ray );
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		packet.o[ i ][ lane ] = tRay.o[ i ];
+		packet.d[ i ][ lane ] = tRay.d[ i ];
+		packet.invD[ i ][ lane ] = tRay.invD[ i ];
+	}
+}
+
+
+template<uint32_t N, typename T>
+inline traceRay_t<T> GetPacketRay( const rayPacket_t<N, T>& packet, const uint32_t lane )
+{
+	traceRay_t<T> tRay;
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		tRay.o[ i ] = packet.o[ i ][ lane ];
+		tRay.d[ i ] = packet.d[ i ][ lane ];
+		tRay.invD[ i ] = packet.invD[ i ][ lane ];
+	}
+	return tRay;
+}
+
+
+// Moves every lane into another space, see TransformTraceRay
+template<uint32_t N, typename T>
+inline void TransformPacket( const mat4x4d& m, const rayPacket_t<N, T>& packet, rayPacket_t<N, T>& outPacket )
+{
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		const traceRay_t<T> tRay = TransformTraceRay( m, GetPacketRay<N, T>( packet, lane ) );
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			outPacket.o[ i ][ lane ] = tRay.o[ i ];
+			outPacket.d[ i ][ lane ] = tRay.d[ i ];
+			outPacket.invD[ i ][ lane ] = tRay.invD[ i ];
+		}
+	}
+}
+
+
+// Returns true if any lane enters the box before its tMax; minEntry is the nearest entry among them
+template<uint32_t N, typename T>
+inline bool IntersectPacketAABB( const rayPacket_t<N, T>& packet, const T boundsMin[ 3 ], const T boundsMax[ 3 ], const T tMax[ N ], T& minEntry )
+{
+	T t0[ N ];
+	T t1[ N ];
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		t0[ lane ] = T( 0 );
+		t1[ lane ] = tMax[ lane ];
+	}
+
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		for ( uint32_t lane = 0; lane < N; ++lane )
+		{
+			const T tA = ( boundsMin[ i ] - packet.o[ i ][ lane ] ) * packet.invD[ i ][ lane ];
+			const T tB = ( boundsMax[ i ] - packet.o[ i ][ lane ] ) * packet.invD[ i ][ lane ];
+			const T tNear = ( tA < tB ) ? tA : tB;
+			const T tFar = ( ( tA < tB ) ? tB : tA ) * traceEpsilon_t<T>::SlabScale;
+			t0[ lane ] = ( tNear > t0[ lane ] ) ? tNear : t0[ lane ];
+			t1[ lane ] = ( tFar < t1[ lane ] ) ? tFar : t1[ lane ];
+		}
+	}
+
+	T nearest = std::numeric_limits<T>::max();
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		const T entry = ( t0[ lane ] <= t1[ lane ] ) ? t0[ lane ] : std::numeric_limits<T>::max();
+		nearest = ( entry < nearest ) ? entry : nearest;
+	}
+
+	minEntry = nearest;
+	return nearest != std::numeric_limits<T>::max();
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include "primitive.h"
+
+static primitive_t MakePrimitive( const primitiveType_t type, const vec3d& center, const Color& color, const matHdl_t materialId )
+{
+	primitive_t prim;
+	prim.type = type;
+	prim.center = center;
+	prim.normal = vec3d( 0.0, 0.0, 1.0 );
+	prim.tangent = vec3d( 1.0, 0.0, 0.0 );
+	prim.halfSize = vec3d( 0.0 );
+	prim.radius = 0.0;
+	prim.color = color;
+	prim.materialId = materialId;
+	return prim;
+}
+
+
+primitive_t MakeSphere( const vec3d& center, const double radius, const Color& color, const matHdl_t materialId )
+{
+	primitive_t prim = MakePrimitive( PRIM_SPHERE, center, color, materialId );
+	prim.radius = radius;
+	return prim;
+}
+
+
+primitive_t MakePlane( const vec3d& center, const vec3d& normal, const vec3d& tangent, const vec2d& halfSize, const Color& color, const matHdl_t materialId )
+{
+	primitive_t prim = MakePrimitive( PRIM_PLANE, center, color, materialId );
+	prim.normal = normal.Normalize();
+
+	// Drop any part of the tangent along the normal so the rectangle stays in its plane
+	prim.tangent = ( tangent - Dot( tangent, prim.normal ) * prim.normal ).Normalize();
+	prim.halfSize = vec3d( halfSize[ 0 ], halfSize[ 1 ], 0.0 );
+	return prim;
+}
+
+
+primitive_t MakeDisk( const vec3d& center, const vec3d& normal, const double radius, const Color& color, const matHdl_t materialId )
+{
+	primitive_t prim = MakePrimitive( PRIM_DISK, center, color, materialId );
+	prim.normal = normal.Normalize();
+	prim.radius = radius;
+	return prim;
+}
+
+
+primitive_t MakeBox( const vec3d& boundsMin, const vec3d& boundsMax, const Color& color, const matHdl_t materialId )
+{
+	primitive_t prim = MakePrimitive( PRIM_BOX, 0.5 * ( boundsMin + boundsMax ), color, materialId );
+	prim.halfSize = 0.5 * ( boundsMax - boundsMin );
+	return prim;
+}
+
+
+AABB PrimitiveBounds( const primitive_t& prim )
+{
+	vec3d extent;
+	switch ( prim.type )
+	{
+	case PRIM_SPHERE:
+		extent = vec3d( prim.radius );
+		break;
+	case PRIM_PLANE:
+	{
+		const vec3d bitangent = Cross( prim.normal, prim.tangent );
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			extent[ i ] = fabs( prim.tangent[ i ] ) * prim.halfSize[ 0 ] + fabs( bitangent[ i ] ) * prim.halfSize[ 1 ];
+		}
+		break;
+	}
+	case PRIM_DISK:
+		// Half width of the disk's ellipse projected onto each axis
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			extent[ i ] = prim.radius * sqrt( std::max( 0.0, 1.0 - prim.normal[ i ] * prim.normal[ i ] ) );
+		}
+		break;
+	case PRIM_BOX:
+	default:
+		extent = prim.halfSize;
+		break;
+	}
+
+	AABB bounds;
+	bounds.Expand( prim.center - extent );
+	bounds.Expand( prim.center + extent );
+	return bounds;
+}
+
+
+vec3d PrimitiveNormal( const primitive_t& prim, const vec3d& pt )
+{
+	switch ( prim.type )
+	{
+	case PRIM_SPHERE:
+		return ( 1.0 / prim.radius ) * ( pt - prim.center );
+	case PRIM_PLANE:
+	case PRIM_DISK:
+		return prim.normal;
+	case PRIM_BOX:
+	default:
+	{
+		// The face hit is the axis where the point lies farthest out relative to the box size
+		int32_t axis = 0;
+		double farthest = -1.0;
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			const double rel = ( prim.halfSize[ i ] > 0.0 ) ? fabs( ( pt[ i ] - prim.center[ i ] ) / prim.halfSize[ i ] ) : 1.0;
+			if ( rel > farthest )
+			{
+				farthest = rel;
+				axis = i;
+			}
+		}
+
+		vec3d n = vec3d( 0.0 );
+		n[ axis ] = ( pt[ axis ] >= prim.center[ axis ] ) ? 1.0 : -1.0;
+		return n;
+	}
+	}
+}
+
+
+// Appends one triangle, flipped if needed so it winds counter-clockwise around the outward normal
+static void AddTessTriangle( const primitive_t& prim, const vec3d pos[ 3 ], const vec3d normal[ 3 ], const vec2d uv[ 3 ], std::vector<Triangle>& outTris )
+{
+	vec3d faceNormal = Cross( pos[ 1 ] - pos[ 0 ], pos[ 2 ] - pos[ 0 ] );
+	if ( Dot( faceNormal, faceNormal ) == 0.0 )
+	{
+		return;
+	}
+
+	uint32_t order[ 3 ] = { 0, 1, 2 };
+	if ( Dot( faceNormal, normal[ 0 ] + normal[ 1 ] + normal[ 2 ] ) < 0.0 )
+	{
+		std::swap( order[ 1 ], order[ 2 ] );
+		faceNormal = -1.0 * faceNormal;
+	}
+
+	Triangle tri;
+	vertex_t* verts[ 3 ] = { &tri.v0, &tri.v1, &tri.v2 };
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		verts[ i ]->pos = vec4d( pos[ order[ i ] ], 1.0 );
+		verts[ i ]->normal = normal[ order[ i ] ];
+		verts[ i ]->uv = uv[ order[ i ] ];
+		verts[ i ]->color = prim.color;
+	}
+	tri.n = faceNormal.Normalize();
+	tri.materialId = prim.materialId;
+	outTris.push_back( tri );
+}
+
+
+// Two triangles over the quad c0, c1, c2, c3 with one normal
+static void AddTessQuad( const primitive_t& prim, const vec3d& c0, const vec3d& c1, const vec3d& c2, const vec3d& c3, const vec3d& normal, std::vector<Triangle>& outTris )
+{
+	const vec3d normals[ 3 ] = { normal, normal, normal };
+
+	const vec3d pos0[ 3 ] = { c0, c1, c2 };
+	const vec2d uv0[ 3 ] = { vec2d( 0.0, 0.0 ), vec2d( 1.0, 0.0 ), vec2d( 1.0, 1.0 ) };
+	AddTessTriangle( prim, pos0, normals, uv0, outTris );
+
+	const vec3d pos1[ 3 ] = { c0, c2, c3 };
+	const vec2d uv1[ 3 ] = { vec2d( 0.0, 0.0 ), vec2d( 1.0, 1.0 ), vec2d( 0.0, 1.0 ) };
+	AddTessTriangle( prim, pos1, normals, uv1, outTris );
+}
+
+
+void TessellatePrimitive( const primitive_t& prim, std::vector<Triangle>& outTris )
+{
+	const double Pi = 3.14159265358979323846;
+
+	switch ( prim.type )
+	{
+	case PRIM_SPHERE:
+	{
+		const uint32_t ringCnt = PrimitiveTessSegments / 2;
+		auto dirAt = [&]( const uint32_t ring, const uint32_t segment )
+		{
+			const double theta = Pi * ring / ringCnt;
+			const double phi = 2.0 * Pi * segment / PrimitiveTessSegments;
+			return vec3d( sin( theta ) * cos( phi ), sin( theta ) * sin( phi ), cos( theta ) );
+		};
+
+		for ( uint32_t ring = 0; ring < ringCnt; ++ring )
+		{
+			for ( uint32_t segment = 0; segment < PrimitiveTessSegments; ++segment )
+			{
+				const vec3d d[ 4 ] = { dirAt( ring, segment ), dirAt( ring, segment + 1 ), dirAt( ring + 1, segment + 1 ), dirAt( ring + 1, segment ) };
+				const vec2d uv[ 4 ] = {	vec2d( segment / (double)PrimitiveTessSegments, ring / (double)ringCnt ),
+										vec2d( ( segment + 1 ) / (double)PrimitiveTessSegments, ring / (double)ringCnt ),
+										vec2d( ( segment + 1 ) / (double)PrimitiveTessSegments, ( ring + 1 ) / (double)ringCnt ),
+										vec2d( segment / (double)PrimitiveTessSegments, ( ring + 1 ) / (double)ringCnt ) };
+
+				// Triangles collapsed at the poles have no area and are dropped
+				const uint32_t tris[ 2 ][ 3 ] = { { 0, 1, 2 }, { 0, 2, 3 } };
+				for ( int32_t t = 0; t < 2; ++t )
+				{
+					vec3d pos[ 3 ];
+					vec3d normal[ 3 ];
+					vec2d triUv[ 3 ];
+					for ( int32_t i = 0; i < 3; ++i )
+					{
+						normal[ i ] = d[ tris[ t ][ i ] ];
+						pos[ i ] = prim.center + prim.radius * normal[ i ];
+						triUv[ i ] = uv[ tris[ t ][ i ] ];
+					}
+					AddTessTriangle( prim, pos, normal, triUv, outTris );
+				}
+			}
+		}
+		break;
+	}
+	case PRIM_PLANE:
+	{
+		const vec3d u = prim.halfSize[ 0 ] * prim.tangent;
+		const vec3d v = prim.halfSize[ 1 ] * Cross( prim.normal, prim.tangent );
+		AddTessQuad( prim, prim.center - u - v, prim.center + u - v, prim.center + u + v, prim.center - u + v, prim.normal, outTris );
+		break;
+	}
+	case PRIM_DISK:
+	{
+		// Any axis not parallel to the normal gives a frame in the disk's plane
+		const vec3d axis = ( fabs( prim.normal[ 0 ] ) < 0.9 ) ? vec3d( 1.0, 0.0, 0.0 ) : vec3d( 0.0, 1.0, 0.0 );
+		const vec3d u = Cross( prim.normal, axis ).Normalize();
+		const vec3d v = Cross( prim.normal, u );
+		const vec3d normals[ 3 ] = { prim.normal, prim.normal, prim.normal };
+
+		for ( uint32_t segment = 0; segment < PrimitiveTessSegments; ++segment )
+		{
+			const double phi0 = 2.0 * Pi * segment / PrimitiveTessSegments;
+			const double phi1 = 2.0 * Pi * ( segment + 1 ) / PrimitiveTessSegments;
+			const vec3d pos[ 3 ] = {	prim.center,
+										prim.center + prim.radius * ( cos( phi0 ) * u + sin( phi0 ) * v ),
+										prim.center + prim.radius * ( cos( phi1 ) * u + sin( phi1 ) * v ) };
+			const vec2d uv[ 3 ] = {	vec2d( 0.5, 0.5 ),
+									vec2d( 0.5 + 0.5 * cos( phi0 ), 0.5 + 0.5 * sin( phi0 ) ),
+									vec2d( 0.5 + 0.5 * cos( phi1 ), 0.5 + 0.5 * sin( phi1 ) ) };
+			AddTessTriangle( prim, pos, normals, uv, outTris );
+		}
+		break;
+	}
+	case PRIM_BOX:
+	default:
+	{
+		for ( int32_t axis = 0; axis < 3; ++axis )
+		{
+			const int32_t a1 = ( axis + 1 ) % 3;
+			const int32_t a2 = ( axis + 2 ) % 3;
+			for ( int32_t side = -1; side <= 1; side += 2 )
+			{
+				vec3d normal = vec3d( 0.0 );
+				normal[ axis ] = side;
+
+				vec3d u = vec3d( 0.0 );
+				vec3d v = vec3d( 0.0 );
+				u[ a1 ] = prim.halfSize[ a1 ];
+				v[ a2 ] = prim.halfSize[ a2 ];
+				const vec3d faceCenter = prim.center + prim.halfSize[ axis ] * normal;
+				AddTessQuad( prim, faceCenter - u - v, faceCenter + u - v, faceCenter + u + v, faceCenter - u + v, normal, outTris );
+			}
+		}
+		break;
+	}
+	}
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <float.h>
+#include "../GfxCore/mathVector.h"
+#include "../GfxCore/color.h"
+#include "../GfxCore/geom.h"
+#include "../GfxCore/resourceManager.h"
+#include "intersect.h"
+#include "packet.h"
+
+static const uint32_t PrimitiveTessSegments	= 32;	// Divisions around a tessellated sphere or disk
+
+enum primitiveType_t : uint32_t
+{
+	PRIM_SPHERE,
+	PRIM_PLANE,		// Rectangle of halfSize[ 0 ] by halfSize[ 1 ] around center
+	PRIM_DISK,
+	PRIM_BOX,		// Axis aligned
+};
+
+
+// Analytic surface placed directly in world space. Fields a type doesn't use are ignored.
+struct primitive_t
+{
+	primitiveType_t	type;
+	vec3d			center;
+	vec3d			normal;		// Plane and disk, unit length
+	vec3d			tangent;	// Plane: unit direction of halfSize[ 0 ], perpendicular to normal
+	vec3d			halfSize;	// Plane: extents along tangent and Cross( normal, tangent ). Box: extents per axis
+	double			radius;		// Sphere and disk
+	Color			color;
+	matHdl_t		materialId;
+};
+
+
+primitive_t MakeSphere( const vec3d& center, const double radius, const Color& color, const matHdl_t materialId );
+primitive_t MakePlane( const vec3d& center, const vec3d& normal, const vec3d& tangent, const vec2d& halfSize, const Color& color, const matHdl_t materialId );
+primitive_t MakeDisk( const vec3d& center, const vec3d& normal, const double radius, const Color& color, const matHdl_t materialId );
+primitive_t MakeBox( const vec3d& boundsMin, const vec3d& boundsMax, const Color& color, const matHdl_t materialId );
+
+AABB PrimitiveBounds( const primitive_t& prim );
+
+// Exact outward normal at a point on the surface
+vec3d PrimitiveNormal( const primitive_t& prim, const vec3d& pt );
+
+// Appends a world-space triangle approximation, counter-clockwise seen from outside, for the rasterizer
+void TessellatePrimitive( const primitive_t& prim, std::vector<Triangle>& outTris );
+
+
+// Nearest root of the ray against the surface in ( HitT, tMax ). With cullBackfaces only hits
+// where the ray enters a closed primitive, or meets the front of a flat one, count. The solve runs
+// in double whatever T is, so a float trace keeps exact sphere silhouettes.
+template<typename T>
+inline bool IntersectRayPrimitive( const traceRay_t<T>& ray, const primitive_t& prim, const bool cullBackfaces, const T tMax, T& tHit )
+{
+	const vec3d o = vec3d( ray.o[ 0 ], ray.o[ 1 ], ray.o[ 2 ] );
+	const vec3d d = vec3d( ray.d[ 0 ], ray.d[ 1 ], ray.d[ 2 ] );
+	const double tMin = traceEpsilon_t<T>::HitT;
+
+	double tNear = -DBL_MAX;
+	double tFar = -DBL_MAX;
+
+	switch ( prim.type )
+	{
+	case PRIM_SPHERE:
+	{
+		// a t^2 + 2 b t + c = 0. The discriminant is taken from the ray's closest approach to
+		// the center rather than b^2 - a c, which cancels badly for distant spheres.
+		const vec3d f = o - prim.center;
+		const double a = Dot( d, d );
+		const double b = Dot( f, d );
+		const double c = Dot( f, f ) - prim.radius * prim.radius;
+		const vec3d l = f - ( b / a ) * d;
+		const double discr = a * ( prim.radius * prim.radius - Dot( l, l ) );
+		if ( discr < 0.0 )
+		{
+			return false;
+		}
+
+		const double q = -( b + std::copysign( sqrt( discr ), b ) );
+		const double t0 = q / a;
+		const double t1 = ( q != 0.0 ) ? ( c / q ) : t0;
+		tNear = std::min( t0, t1 );
+		tFar = std::max( t0, t1 );
+		break;
+	}
+	case PRIM_PLANE:
+	case PRIM_DISK:
+	{
+		const double denom = Dot( prim.normal, d );
+		if ( denom == 0.0 )
+		{
+			return false;
+		}
+
+		const double t = Dot( prim.center - o, prim.normal ) / denom;
+		const vec3d local = ( o + t * d ) - prim.center;
+		if ( prim.type == PRIM_PLANE )
+		{
+			const vec3d bitangent = Cross( prim.normal, prim.tangent );
+			if ( ( fabs( Dot( local, prim.tangent ) ) > prim.halfSize[ 0 ] ) || ( fabs( Dot( local, bitangent ) ) > prim.halfSize[ 1 ] ) )
+			{
+				return false;
+			}
+		}
+		else if ( Dot( local, local ) > prim.radius * prim.radius )
+		{
+			return false;
+		}
+
+		// A flat surface has one root; it is the near one when the ray meets the front
+		if ( denom < 0.0 )
+		{
+			tNear = t;
+		}
+		else
+		{
+			tFar = t;
+		}
+		break;
+	}
+	case PRIM_BOX:
+	{
+		tNear = -DBL_MAX;
+		tFar = DBL_MAX;
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			const double invD = ray.invD[ i ];
+			double tA = ( prim.center[ i ] - prim.halfSize[ i ] - o[ i ] ) * invD;
+			double tB = ( prim.center[ i ] + prim.halfSize[ i ] - o[ i ] ) * invD;
+			if ( tA > tB )
+			{
+				std::swap( tA, tB );
+			}
+			tNear = std::max( tNear, tA );
+			tFar = std::min( tFar, tB );
+		}
+		if ( tNear > tFar )
+		{
+			return false;
+		}
+		break;
+	}
+	default:
+		return false;
+	}
+
+	if ( ( tNear > tMin ) && ( tNear < tMax ) )
+	{
+		tHit = static_cast<T>( tNear );
+		return true;
+	}
+	if ( !cullBackfaces && ( tFar > tMin ) && ( tFar < tMax ) )
+	{
+		tHit = static_cast<T>( tFar );
+		return true;
+	}
+	return false;
+}
+
+
+// Tests every lane against one primitive and records closer hits as scene object objectIx
+template<uint32_t N, typename T>
+inline void IntersectPacketPrimitive( const rayPacket_t<N, T>& packet, const primitive_t& prim, const uint32_t objectIx, const bool cullBackfaces, packetHit_t<N, T>& hits )
+{
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		T t;
+		if ( IntersectRayPrimitive( GetPacketRay<N, T>( packet, lane ), prim, cullBackfaces, hits.t[ lane ], t ) )
+		{
+			hits.t[ lane ] = t;
+			hits.u[ lane ] = T( 0 );
+			hits.v[ lane ] = T( 0 );
+			hits.triIx[ lane ] = 0;
+			hits.instanceIx[ lane ] = objectIx;
+		}
+	}
+}
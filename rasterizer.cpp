@@ -1,3 +1,10 @@
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
 #include "../GfxCore/bitmap.h"
 #include "../GfxCore/mathVector.h"
 #include "../GfxCore/matrix.h"
@@ -6,14 +13,24 @@
 #include "debug.h"
 #include "globals.h"
 #include "../GfxCore/resourceManager.h"
-#include "../GfxCore/octree.h"
 #include "../GfxCore/util.h"
+#include "threadPool.h"
 
 Image<float> zBuffer( RenderWidth, RenderHeight, 1.0f, "_zbuffer" );
 
 extern Scene scene;
 extern Image<float> depthBuffer;
 extern ResourceManager rm;
+extern ThreadPool threadPool;
+
+static const uint32_t RasterTileSize	= 64;	// Pixels per side of a binning tile
+static const uint32_t RasterChunkSize	= 4096;	// Triangles shaded and binned per thread pool task
+static const uint32_t RasterBlockSize	= 8;	// Pixels per side of a coverage block; divides RasterTileSize
+static const int32_t RasterSubPixelBits	= 8;
+static const double RasterGuardBand	= 16.0;	// Clip-space x and y within this many w are rasterized unclipped
+static const double RasterMaxCoord		= ( 1 << 21 );	// Screen coordinates beyond this overflow the 64-bit edge functions
+static const uint32_t MaxClippedTris	= 6;	// Fan of a triangle cut by five clip planes
+static const uint32_t RasterNodeCullMinTris	= 4096;	// Smaller meshes are only frustum culled as a whole
 
 void OrthoMatrixToAxis( const mat4x4d& m, vec3d& origin, vec3d& xAxis, vec3d& yAxis, vec3d& zAxis );
 void DrawWorldAxis( Image<Color>& image, const SceneView& view, double size, const vec3d& origin, const vec3d& X, const vec3d& Y, const vec3d& Z );
@@ -160,220 +177,962 @@ void DrawRay( Image<Color>& image, const SceneView& view, const Ray& ray, const
 
 
 template<typename T>
-void DrawOctree( Image<Color>& image, const SceneView& view, const Octree<T>& octree, const Color& color )
+void DrawBVH( Image<Color>& image, const SceneView& view, const BVH<T>& bvh, const Color& color )
+{
+	const size_t nodeCnt = bvh.nodes.size();
+	for ( size_t i = 0; i < nodeCnt; ++i )
+	{
+		const bvhNode_t<T>& node = bvh.nodes[ i ];
+		const vec4d minCorner = vec4d( node.boundsMin[ 0 ], node.boundsMin[ 1 ], node.boundsMin[ 2 ], 1.0 );
+		const vec4d maxCorner = vec4d( node.boundsMax[ 0 ], node.boundsMax[ 1 ], node.boundsMax[ 2 ], 1.0 );
+		DrawCube( image, view, minCorner, maxCorner, color );
+	}
+}
+
+
+// Clip-space planes a triangle is cut against before projection: the near plane, and a guard band
+// well outside the viewport on each side. Triangles inside the band are left for the edge functions
+// to trim, so only geometry that nearly passes through the camera ever gets clipped.
+enum clipPlane_t : uint32_t
+{
+	CLIP_NEAR,
+	CLIP_GUARD_LEFT,
+	CLIP_GUARD_RIGHT,
+	CLIP_GUARD_BOTTOM,
+	CLIP_GUARD_TOP,
+	CLIP_PLANE_COUNT,
+};
+
+
+// Positive inside the plane
+inline double ClipDistance( const vec4d& clipPt, const clipPlane_t plane )
+{
+	const double guard = RasterGuardBand * clipPt[ 3 ];
+	switch ( plane )
+	{
+	case CLIP_NEAR:				return clipPt[ 2 ] + clipPt[ 3 ];
+	case CLIP_GUARD_LEFT:		return guard + clipPt[ 0 ];
+	case CLIP_GUARD_RIGHT:		return guard - clipPt[ 0 ];
+	case CLIP_GUARD_BOTTOM:		return guard + clipPt[ 1 ];
+	case CLIP_GUARD_TOP:
+	default:					return guard - clipPt[ 1 ];
+	}
+}
+
+
+// Bit per frustum plane the point is outside of
+inline uint32_t FrustumOutcode( const vec4d& clipPt )
+{
+	const double w = clipPt[ 3 ];
+	return	( ( clipPt[ 0 ] < -w ) ? 0x01 : 0 ) | ( ( clipPt[ 0 ] > w ) ? 0x02 : 0 ) |
+			( ( clipPt[ 1 ] < -w ) ? 0x04 : 0 ) | ( ( clipPt[ 1 ] > w ) ? 0x08 : 0 ) |
+			( ( clipPt[ 2 ] < -w ) ? 0x10 : 0 ) | ( ( clipPt[ 2 ] > w ) ? 0x20 : 0 );
+}
+
+
+// Writes the triangle of tri whose corners sit at the barycentric points baryPts
+static void EmitClippedTriangle( const SceneView& view, const Triangle& tri, const vec3d baryPts[ 3 ], vertexOut_t& outVertex )
 {
-	AABB bounds = octree.GetAABB();
-	DrawCube( image, view, vec4d( bounds.min, 1.0 ), vec4d( bounds.max, 1.0 ), color );
+	const vec4d wsPos[ 3 ] = { tri.v0.pos, tri.v1.pos, tri.v2.pos };
+	const Color color[ 3 ] = { tri.v0.color, tri.v1.color, tri.v2.color };
+	const vec2d uv[ 3 ] = { tri.v0.uv, tri.v1.uv, tri.v2.uv };
+	const vec3d normal[ 3 ] = { tri.v0.normal, tri.v1.normal, tri.v2.normal };
 
-	auto nodeEnd = octree.children.end();
-	for ( auto node = octree.children.begin(); node != nodeEnd; ++node )
+	for ( int32_t i = 0; i < 3; ++i )
 	{
-		DrawOctree( image, view, *node, color );
+		outVertex.wsPosition[ i ] = Interpolate( baryPts[ i ], wsPos );
+		outVertex.color[ i ] = Interpolate( baryPts[ i ], color );
+		outVertex.uv[ i ] = Interpolate( baryPts[ i ], uv );
+		outVertex.normal[ i ] = Interpolate( baryPts[ i ], normal );
+		ProjectPoint( view.projView, RenderSize, outVertex.wsPosition[ i ], outVertex.clipPosition[ i ] );
 	}
 }
 
 
-bool VertexShader( const SceneView& view, const Triangle& tri, vertexOut_t& outVertex )
+// Returns how many triangles were written to outTris. Triangles wholly outside one frustum plane
+// are culled; the rest are clipped in homogeneous space against the near plane and guard band,
+// so every vertex projects in front of the camera to a bounded screen position.
+uint32_t VertexShader( const SceneView& view, const Triangle& tri, vertexOut_t outTris[ MaxClippedTris ] )
 {
 	const mat4x4d& mvp = view.projView;
 
-	const vec4d* wsPts[ 3 ];
-	vec4d ssPts[ 3 ];
-	bool culled = false;
+	vec4d clipPts[ 3 ];
+	clipPts[ 0 ] = mvp * tri.v0.pos;
+	clipPts[ 1 ] = mvp * tri.v1.pos;
+	clipPts[ 2 ] = mvp * tri.v2.pos;
 
-	wsPts[ 0 ] = &tri.v0.pos;
-	wsPts[ 1 ] = &tri.v1.pos;
-	wsPts[ 2 ] = &tri.v2.pos;
+	const uint32_t outcode0 = FrustumOutcode( clipPts[ 0 ] );
+	const uint32_t outcode1 = FrustumOutcode( clipPts[ 1 ] );
+	const uint32_t outcode2 = FrustumOutcode( clipPts[ 2 ] );
+	const bool culled = ( outcode0 & outcode1 & outcode2 ) != 0;
+	if ( culled )
+	{
+		return 0;
+	}
 
-	ProjectPoint( mvp, RenderSize, *wsPts[ 0 ], ssPts[ 0 ] );
-	ProjectPoint( mvp, RenderSize, *wsPts[ 1 ], ssPts[ 1 ] );
-	ProjectPoint( mvp, RenderSize, *wsPts[ 2 ], ssPts[ 2 ] );
+	// Clip the polygon as barycentric points of the source triangle. Clip position is linear in
+	// them, and so is every attribute, which keeps the clipped corners exact.
+	vec3d poly[ MaxClippedTris + 2 ];
+	vec3d nextPoly[ MaxClippedTris + 2 ];
+	uint32_t polyCnt = 3;
+	poly[ 0 ] = vec3d( 1.0, 0.0, 0.0 );
+	poly[ 1 ] = vec3d( 0.0, 1.0, 0.0 );
+	poly[ 2 ] = vec3d( 0.0, 0.0, 1.0 );
 
-	const bool nearClip = ( ssPts[ 0 ][ 2 ] < -1.0 ) && ( ssPts[ 1 ][ 2 ] < -1.0 ) && ( ssPts[ 2 ][ 2 ] < -1.0 );
+	for ( uint32_t planeIx = 0; planeIx < CLIP_PLANE_COUNT; ++planeIx )
+	{
+		const clipPlane_t plane = static_cast<clipPlane_t>( planeIx );
+		const double d0 = ClipDistance( clipPts[ 0 ], plane );
+		const double d1 = ClipDistance( clipPts[ 1 ], plane );
+		const double d2 = ClipDistance( clipPts[ 2 ], plane );
+		if ( ( d0 >= 0.0 ) && ( d1 >= 0.0 ) && ( d2 >= 0.0 ) )
+		{
+			continue;
+		}
 
-	if( !culled && !nearClip )
+		uint32_t nextCnt = 0;
+		for ( uint32_t i = 0; i < polyCnt; ++i )
+		{
+			const vec3d& a = poly[ i ];
+			const vec3d& b = poly[ ( i + 1 ) % polyCnt ];
+			const double da = a[ 0 ] * d0 + a[ 1 ] * d1 + a[ 2 ] * d2;
+			const double db = b[ 0 ] * d0 + b[ 1 ] * d1 + b[ 2 ] * d2;
+
+			if ( da >= 0.0 )
+			{
+				nextPoly[ nextCnt++ ] = a;
+			}
+			if ( ( da >= 0.0 ) != ( db >= 0.0 ) )
+			{
+				const double t = da / ( da - db );
+				nextPoly[ nextCnt++ ] = ( 1.0 - t ) * a + t * b;
+			}
+		}
+
+		polyCnt = nextCnt;
+		if ( polyCnt < 3 )
+		{
+			return 0;
+		}
+		for ( uint32_t i = 0; i < polyCnt; ++i )
+		{
+			poly[ i ] = nextPoly[ i ];
+		}
+	}
+
+	// Fan the convex result back into triangles
+	uint32_t triCnt = 0;
+	for ( uint32_t i = 1; ( i + 1 ) < polyCnt; ++i )
 	{
-		outVertex.clipPosition[ 0 ] = ssPts[ 0 ];
-		outVertex.wsPosition[ 0 ] = tri.v0.pos;
-		outVertex.color[ 0 ] = tri.v0.color;
-		outVertex.uv[ 0 ] = tri.v0.uv;
-		outVertex.normal[ 0 ] = tri.v0.normal;
+		const vec3d baryPts[ 3 ] = { poly[ 0 ], poly[ i ], poly[ i + 1 ] };
+		EmitClippedTriangle( view, tri, baryPts, outTris[ triCnt++ ] );
+	}
+	return triCnt;
+}
 
-		outVertex.clipPosition[ 1 ] = ssPts[ 1 ];
-		outVertex.wsPosition[ 1 ] = tri.v1.pos;
-		outVertex.color[ 1 ] = tri.v1.color;
-		outVertex.uv[ 1 ] = tri.v1.uv;
-		outVertex.normal[ 1 ] = tri.v1.normal;
 
-		outVertex.clipPosition[ 2 ] = ssPts[ 2 ];
-		outVertex.wsPosition[ 2 ] = tri.v2.pos;
-		outVertex.color[ 2 ] = tri.v2.color;
-		outVertex.uv[ 2 ] = tri.v2.uv;
-		outVertex.normal[ 2 ] = tri.v2.normal;
+// Coverage is decided by the edge functions, so every fragment that gets here is interpolated
+void EmitFragment( const vec3d& baryPt, const vertexOut_t& vo, fragmentInput_t& outFragment )
+{
+	outFragment.wsPosition = Interpolate( baryPt, vo.wsPosition ); // TODO: is this ok?
+	outFragment.clipPosition = Interpolate( baryPt, vo.clipPosition );
+	outFragment.normal = Interpolate( baryPt, vo.normal );
+	outFragment.uv = Interpolate( baryPt, vo.uv );
+	outFragment.color = Interpolate( baryPt, vo.color );
+}
+
+
+// Blinn-Phong against the first light, in linear color
+Color ShadeFragment( const SceneView& view, const material_t& material, const fragmentInput_t& fragmentInput )
+{
+	const vec3d normal = fragmentInput.normal.Normalize();
+
+	const light_t& L = scene.lights[ 0 ];
+	const vec4d intensity = vec4d( L.intensity, 1.0f );
 
-		return true;
+	vec3d lightDir = L.pos - Trunc<4, 1>( fragmentInput.wsPosition );
+	lightDir = lightDir.Normalize();
+
+	const vec3d viewVector = Trunc<4, 1>( view.camera.origin - fragmentInput.wsPosition ).Normalize();
+
+	const vec3d halfVector = ( viewVector + lightDir ).Normalize();
+
+	Color surfaceColor = Color::Black;
+
+	if( material.textured )
+	{
+		const Image<Color>* texture = rm.GetImageRef( material.colorMapId );
+		surfaceColor = texture->GetPixelUV( fragmentInput.uv[ 0 ], fragmentInput.uv[ 1 ] );
 	}
 	else
 	{
-		return false;
+		surfaceColor += fragmentInput.color;
 	}
+
+	const vec4d D = ColorToVector( Color( material.Kd ) );
+	const vec4d S = ColorToVector( Color( material.Ks ) );
+
+	const vec4d diffuseIntensity = Multiply( D, intensity ) * std::max( 0.0, Dot( normal, lightDir ) );
+	const vec4d specularIntensity = S * pow( std::max( 0.0, Dot( normal, halfVector ) ), SpecularPower );
+	const Color ambient = AmbientLight * ( Color( material.Ka ) * surfaceColor );
+
+	Color shadingColor;
+	shadingColor += Vec4dToColor( specularIntensity );
+	shadingColor += Vec4dToColor( Multiply( diffuseIntensity, ColorToVector( surfaceColor ) ) );
+	shadingColor += ambient;
+
+	return shadingColor;
 }
 
 
-bool EmitFragment( const vec3d& baryPt, const vertexOut_t& vo, fragmentInput_t& outFragment )
+bool PixelShader( const fragmentInput_t & frag )
+{
+	return false;
+}
+
+
+// Half-space edge functions of a screen triangle in fixed point. Edge k runs between the two
+// vertices other than vertexIx[ k ], and its value at a pixel is that vertex's barycentric weight
+// scaled by the doubled area. Vertices are ordered so covered pixels have every edge >= 0.
+struct triEdges_t
 {
-	if( ( baryPt[ 0 ] < 0.0 ) || ( baryPt[ 1 ] < 0.0 ) || ( baryPt[ 2 ] < 0.0 ) )
+	int64_t		a[ 3 ];		// Change per pixel step in x
+	int64_t		b[ 3 ];		// Change per pixel step in y
+	int64_t		c[ 3 ];		// Value at pixel ( 0, 0 ), fill rule bias included
+	uint32_t	vertexIx[ 3 ];
+	double		invArea;
+	bool		blockFits32;	// An edge crossing a block stays within int32 at all its pixels
+};
+
+
+// Vertex shader output of one clipped triangle and the screen rectangle it may cover
+struct rasterTri_t
+{
+	vertexOut_t	vo;
+	triEdges_t	edges;
+	int32_t		x0;		// Inclusive pixel bounds, clamped to the target
+	int32_t		y0;
+	int32_t		x1;
+	int32_t		y1;
+	matHdl_t	materialId;
+};
+
+
+inline int64_t EdgeAt( const triEdges_t& edges, const int32_t k, const int32_t x, const int32_t y )
+{
+	return edges.a[ k ] * x + edges.b[ k ] * y + edges.c[ k ];
+}
+
+
+// Returns false for triangles with no area or too far off screen for the fixed-point range
+bool SetupEdges( const vertexOut_t& vo, triEdges_t& edges )
+{
+	int64_t px[ 3 ];
+	int64_t py[ 3 ];
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		const double x = vo.clipPosition[ i ][ 0 ];
+		const double y = vo.clipPosition[ i ][ 1 ];
+		if ( !( fabs( x ) < RasterMaxCoord ) || !( fabs( y ) < RasterMaxCoord ) )
+		{
+			return false;
+		}
+		px[ i ] = static_cast<int64_t>( llround( x * ( 1 << RasterSubPixelBits ) ) );
+		py[ i ] = static_cast<int64_t>( llround( y * ( 1 << RasterSubPixelBits ) ) );
+	}
+
+	const int64_t area = ( px[ 1 ] - px[ 0 ] ) * ( py[ 2 ] - py[ 0 ] ) - ( py[ 1 ] - py[ 0 ] ) * ( px[ 2 ] - px[ 0 ] );
+	if ( area == 0 )
 	{
 		return false;
 	}
 
-	if ( ( baryPt[ 0 ] > 1.0 ) || ( baryPt[ 1 ] > 1.0 ) || ( baryPt[ 2 ] > 1.0 ) )
+	uint32_t order[ 3 ] = { 0, 1, 2 };
+	if ( area < 0 )
 	{
-	//	return false;
+		std::swap( order[ 1 ], order[ 2 ] );
 	}
 
-	outFragment.wsPosition = Interpolate( baryPt, vo.wsPosition ); // TODO: is this ok?
-	outFragment.clipPosition = Interpolate( baryPt, vo.clipPosition );
-	outFragment.normal = Interpolate( baryPt, vo.normal );
-	outFragment.uv = Interpolate( baryPt, vo.uv );
-	outFragment.color = Interpolate( baryPt, vo.color );
+	for ( int32_t k = 0; k < 3; ++k )
+	{
+		const uint32_t from = order[ ( k + 1 ) % 3 ];
+		const uint32_t to = order[ ( k + 2 ) % 3 ];
+		const int64_t dx = px[ to ] - px[ from ];
+		const int64_t dy = py[ to ] - py[ from ];
+
+		// Pixels exactly on an edge shared by two triangles go to only one of them
+		const bool ownsEdge = ( dy < 0 ) || ( ( dy == 0 ) && ( dx > 0 ) );
+
+		edges.a[ k ] = -dy * ( 1 << RasterSubPixelBits );
+		edges.b[ k ] = dx * ( 1 << RasterSubPixelBits );
+		edges.c[ k ] = dy * px[ from ] - dx * py[ from ] - ( ownsEdge ? 0 : 1 );
+		edges.vertexIx[ k ] = order[ k ];
+	}
+	edges.invArea = 1.0 / static_cast<double>( ( area < 0 ) ? -area : area );
+
+	// A block an edge crosses has corners of both signs, so every pixel of it is no further
+	// from zero than the edge changes from corner to corner
+	edges.blockFits32 = true;
+	for ( int32_t k = 0; k < 3; ++k )
+	{
+		const int64_t cornerSpan = ( std::abs( edges.a[ k ] ) + std::abs( edges.b[ k ] ) ) * ( RasterBlockSize - 1 );
+		edges.blockFits32 = edges.blockFits32 && ( cornerSpan <= INT32_MAX );
+	}
 
 	return true;
 }
 
 
-bool PixelShader( const fragmentInput_t & frag )
+inline vec3d EdgeBarycentrics( const triEdges_t& edges, const int64_t e[ 3 ] )
 {
-	return false;
+	vec3d baryPt;
+	for ( int32_t k = 0; k < 3; ++k )
+	{
+		baryPt[ edges.vertexIx[ k ] ] = e[ k ] * edges.invArea;
+	}
+	return baryPt;
 }
 
 
-void RasterScene( Image<Color>& image, const SceneView& view, bool wireFrame = true )
+inline float FragmentDepth( const vertexOut_t& vo, const vec3d& baryPt )
 {
-	mat4x4d mvp = view.projTransform * view.viewTransform;
-	const uint32_t modelCnt = scene.models.size();
+	return (float)( baryPt[ 0 ] * vo.clipPosition[ 0 ][ 2 ] + baryPt[ 1 ] * vo.clipPosition[ 1 ][ 2 ] + baryPt[ 2 ] * vo.clipPosition[ 2 ][ 2 ] );
+}
 
-#if DRAW_WIREFRAME
-	for ( uint32_t m = 0; m < modelCnt; ++m )
+
+// Counts for one task, added to the frame totals once the task is done
+struct rasterCounts_t
+{
+	uint64_t	instancesCulled;	// Instance and primitive bounds outside the frustum
+	uint64_t	nodesCulled;		// Mesh BVH nodes outside the frustum
+	uint64_t	nodeTrisCulled;		// Triangles under those nodes
+	uint64_t	backfacesCulled;
+	uint64_t	clippedAway;		// Triangles VertexShader culled or clipped to nothing
+	uint64_t	fragments;			// Covered pixels that reached the depth test
+	uint64_t	depthPassed;		// Nearer than the depth buffer when tested
+	uint64_t	shaded;				// Runs of ShadeFragment
+	uint64_t	pixels;				// Distinct pixels written
+};
+
+
+struct rasterStats_t
+{
+	std::atomic<uint64_t>	instancesCulled;
+	std::atomic<uint64_t>	nodesCulled;
+	std::atomic<uint64_t>	nodeTrisCulled;
+	std::atomic<uint64_t>	backfacesCulled;
+	std::atomic<uint64_t>	clippedAway;
+	std::atomic<uint64_t>	fragments;
+	std::atomic<uint64_t>	depthPassed;
+	std::atomic<uint64_t>	shaded;
+	std::atomic<uint64_t>	pixels;
+
+	rasterStats_t() : instancesCulled( 0 ), nodesCulled( 0 ), nodeTrisCulled( 0 ), backfacesCulled( 0 ), clippedAway( 0 ),
+		fragments( 0 ), depthPassed( 0 ), shaded( 0 ), pixels( 0 ) {}
+
+	void Add( const rasterCounts_t& counts )
 	{
-		const ModelInstance& model = scene.models[ m ];
-		const Triangle* triCache = model.triCache.data();
+		instancesCulled += counts.instancesCulled;
+		nodesCulled += counts.nodesCulled;
+		nodeTrisCulled += counts.nodeTrisCulled;
+		backfacesCulled += counts.backfacesCulled;
+		clippedAway += counts.clippedAway;
+		fragments += counts.fragments;
+		depthPassed += counts.depthPassed;
+		shaded += counts.shaded;
+		pixels += counts.pixels;
+	}
+};
+
 
-		const size_t triCnt = model.triCache.size();
+// Frustum outcodes of the box's corners under m: those every corner shares, and those any corner has
+inline void BoxOutcodes( const mat4x4d& m, const vec3d& boundsMin, const vec3d& boundsMax, uint32_t& allOutside, uint32_t& anyOutside )
+{
+	allOutside = ~0u;
+	anyOutside = 0;
+	for ( int32_t i = 0; i < 8; ++i )
+	{
+		const vec4d corner = vec4d(	( i & 1 ) ? boundsMax[ 0 ] : boundsMin[ 0 ],
+									( i & 2 ) ? boundsMax[ 1 ] : boundsMin[ 1 ],
+									( i & 4 ) ? boundsMax[ 2 ] : boundsMin[ 2 ],
+									1.0 );
+		const uint32_t outcode = FrustumOutcode( m * corner );
+		allOutside &= outcode;
+		anyOutside |= outcode;
+	}
+}
+
+
+// Mesh triangles of an instance that may be in view. Large meshes walk their BVH so subtrees
+// off screen are skipped, and subtrees wholly on screen are taken without further tests.
+void GatherVisibleTriangles( const SceneView& view, const instance_t& instance, std::vector<uint32_t>& outTris, rasterCounts_t& counts )
+{
+	const uint32_t triCnt = static_cast<uint32_t>( scene.models[ instance.meshIx ].triCache.size() );
+	const BVH<real_t>& blas = scene.blas[ instance.meshIx ];
+
+	uint32_t allOutside;
+	uint32_t anyOutside;
+	BoxOutcodes( view.projView, instance.bounds.min, instance.bounds.max, allOutside, anyOutside );
+	if ( allOutside != 0 )
+	{
+		++counts.instancesCulled;
+		return;
+	}
+
+	if ( ( anyOutside == 0 ) || ( triCnt < RasterNodeCullMinTris ) || blas.IsEmpty() )
+	{
+		outTris.resize( triCnt );
 		for ( uint32_t i = 0; i < triCnt; ++i )
 		{
-			vertexOut_t vo;
-			if ( !VertexShader( view, triCache[ i ], vo ) )
+			outTris[ i ] = i;
+		}
+		return;
+	}
+
+	struct stackEntry_t
+	{
+		uint32_t	nodeIx;
+		bool		inside;
+	};
+
+	// Both children are pushed at each level, so depth plus one entries are live at most
+	stackEntry_t stack[ BvhMaxDepth + 1 ];
+	uint32_t stackSize = 0;
+	stack[ stackSize++ ] = { 0, false };
+
+	const mat4x4d mvp = view.projView * instance.transform;
+	while ( stackSize > 0 )
+	{
+		const stackEntry_t entry = stack[ --stackSize ];
+		const bvhNode_t<real_t>& node = blas.nodes[ entry.nodeIx ];
+
+		bool inside = entry.inside;
+		if ( !inside )
+		{
+			const vec3d boundsMin = vec3d( node.boundsMin[ 0 ], node.boundsMin[ 1 ], node.boundsMin[ 2 ] );
+			const vec3d boundsMax = vec3d( node.boundsMax[ 0 ], node.boundsMax[ 1 ], node.boundsMax[ 2 ] );
+			BoxOutcodes( mvp, boundsMin, boundsMax, allOutside, anyOutside );
+			if ( allOutside != 0 )
 			{
+				++counts.nodesCulled;
 				continue;
 			}
+			inside = ( anyOutside == 0 );
+		}
 
-#if USE_RASTERIZE
-			if ( !wireFrame )
+		if ( node.count > 0 )
+		{
+			outTris.insert( outTris.end(), blas.indices.begin() + node.offset, blas.indices.begin() + node.offset + node.count );
+		}
+		else
+		{
+			stack[ stackSize++ ] = { node.offset + 1, inside };
+			stack[ stackSize++ ] = { node.offset, inside };
+		}
+	}
+	counts.nodeTrisCulled += triCnt - outTris.size();
+}
+
+
+// Tessellated primitive triangles that may be in view. Each primitive is culled whole from its
+// bounds, like an instance; primitives have no tree to walk.
+void GatherVisiblePrimitiveTriangles( const SceneView& view, std::vector<uint32_t>& outTris, rasterCounts_t& counts )
+{
+	for ( size_t p = 0; p < scene.primitives.size(); ++p )
+	{
+		const AABB bounds = PrimitiveBounds( scene.primitives[ p ] );
+
+		uint32_t allOutside;
+		uint32_t anyOutside;
+		BoxOutcodes( view.projView, bounds.min, bounds.max, allOutside, anyOutside );
+		if ( allOutside != 0 )
+		{
+			++counts.instancesCulled;
+			continue;
+		}
+
+		for ( uint32_t i = scene.primitiveFirstTri[ p ]; i < scene.primitiveFirstTri[ p + 1 ]; ++i )
+		{
+			outTris.push_back( i );
+		}
+	}
+}
+
+
+// Faces away when the camera is behind the triangle's plane, with the front given by the winding order
+inline bool IsBackface( const SceneView& view, const windingOrder_t winding, const Triangle& tri )
+{
+	const vec3d p0 = Trunc<4, 1>( tri.v0.pos );
+	const vec3d p1 = Trunc<4, 1>( tri.v1.pos );
+	const vec3d p2 = Trunc<4, 1>( tri.v2.pos );
+	const double facing = Dot( Cross( p1 - p0, p2 - p0 ), Trunc<4, 1>( view.camera.origin ) - p0 );
+	return ( winding == WINDING_CCW ) ? ( facing <= 0.0 ) : ( facing >= 0.0 );
+}
+
+
+// Walks the triangle's bounds within [p0, p1) in RasterBlockSize blocks, calling
+// pixelFunc( x, y, e ) for each covered pixel with its three edge values. A block is rejected
+// or accepted whole from its corners; only blocks an edge passes through test each pixel.
+// With SSE2 those test a row at a time in 32-bit lanes relative to the block, stepped down it
+// by adds; whole blocks and edges too steep for 32 bits step the 64-bit values in scalar.
+template<typename PixelFunc>
+void WalkTriangleInTile( const rasterTri_t& rt, const vec2i& p0, const vec2i& p1, PixelFunc&& pixelFunc )
+{
+	const triEdges_t& edges = rt.edges;
+
+	const int32_t x0 = std::max( rt.x0, p0[ 0 ] );
+	const int32_t x1 = std::min( rt.x1, p1[ 0 ] - 1 );
+	const int32_t y0 = std::max( rt.y0, p0[ 1 ] );
+	const int32_t y1 = std::min( rt.y1, p1[ 1 ] - 1 );
+
+	const int32_t blockMask = ~static_cast<int32_t>( RasterBlockSize - 1 );
+
+	for ( int32_t by = ( y0 & blockMask ); by <= y1; by += RasterBlockSize )
+	{
+		for ( int32_t bx = ( x0 & blockMask ); bx <= x1; bx += RasterBlockSize )
+		{
+			const int32_t bxLast = bx + RasterBlockSize - 1;
+			const int32_t byLast = by + RasterBlockSize - 1;
+
+			// Edges are linear, so their extremes over the block are at its corners
+			bool rejected = false;
+			bool accepted = true;
+			bool edgeAccepted[ 3 ];
+			for ( int32_t k = 0; k < 3; ++k )
 			{
-				// Scanline Rasterizer
-				AABB ssBox;
-				for ( int i = 0; i < 3; ++i )
+				const int64_t e00 = EdgeAt( edges, k, bx, by );
+				const int64_t e10 = EdgeAt( edges, k, bxLast, by );
+				const int64_t e01 = EdgeAt( edges, k, bx, byLast );
+				const int64_t e11 = EdgeAt( edges, k, bxLast, byLast );
+				edgeAccepted[ k ] = ( std::min( std::min( e00, e10 ), std::min( e01, e11 ) ) >= 0 );
+				rejected = rejected || ( std::max( std::max( e00, e10 ), std::max( e01, e11 ) ) < 0 );
+				accepted = accepted && edgeAccepted[ k ];
+			}
+
+			if ( rejected )
+			{
+				continue;
+			}
+
+			const int32_t spanX0 = std::max( bx, x0 );
+			const int32_t spanX1 = std::min( bxLast, x1 );
+			const int32_t spanY0 = std::max( by, y0 );
+			const int32_t spanY1 = std::min( byLast, y1 );
+
+			// Edge values at the block's left column, stepped down its rows
+			int64_t rowE[ 3 ];
+			for ( int32_t k = 0; k < 3; ++k )
+			{
+				rowE[ k ] = EdgeAt( edges, k, bx, spanY0 );
+			}
+
+#if USE_SSE2_KERNEL
+			if ( !accepted && edges.blockFits32 )
+			{
+				// Crossing edges are within int32 over the block; edges that accept it are held
+				// at zero so they never clear a lane
+				__m128i lanes[ 3 ][ 2 ];
+				__m128i rowStep[ 3 ];
+				for ( int32_t k = 0; k < 3; ++k )
 				{
-					ssBox.Expand( Trunc<4, 1>( vo.clipPosition[ i ] ) );
+					if ( edgeAccepted[ k ] )
+					{
+						lanes[ k ][ 0 ] = _mm_setzero_si128();
+						lanes[ k ][ 1 ] = _mm_setzero_si128();
+						rowStep[ k ] = _mm_setzero_si128();
+						continue;
+					}
+					const int32_t e = static_cast<int32_t>( rowE[ k ] );
+					const int32_t a = static_cast<int32_t>( edges.a[ k ] );
+					lanes[ k ][ 0 ] = _mm_setr_epi32( e, e + a, e + 2 * a, e + 3 * a );
+					lanes[ k ][ 1 ] = _mm_add_epi32( lanes[ k ][ 0 ], _mm_set1_epi32( 4 * a ) );
+					rowStep[ k ] = _mm_set1_epi32( static_cast<int32_t>( edges.b[ k ] ) );
 				}
 
-				const vec3d tPt0 = Trunc<4, 1>( vo.clipPosition[ 0 ] );
-				const vec3d tPt1 = Trunc<4, 1>( vo.clipPosition[ 1 ] );
-				const vec3d tPt2 = Trunc<4, 1>( vo.clipPosition[ 2 ] );
+				const uint32_t spanMask = ( ( 1u << ( spanX1 - spanX0 + 1 ) ) - 1 ) << ( spanX0 - bx );
+
+				for ( int32_t y = spanY0; y <= spanY1; ++y )
+				{
+					// A pixel is outside if any edge is negative, which the OR keeps in the sign bit
+					const __m128i lo = _mm_or_si128( _mm_or_si128( lanes[ 0 ][ 0 ], lanes[ 1 ][ 0 ] ), lanes[ 2 ][ 0 ] );
+					const __m128i hi = _mm_or_si128( _mm_or_si128( lanes[ 0 ][ 1 ], lanes[ 1 ][ 1 ] ), lanes[ 2 ][ 1 ] );
+					const uint32_t outside = _mm_movemask_ps( _mm_castsi128_ps( lo ) ) | ( _mm_movemask_ps( _mm_castsi128_ps( hi ) ) << 4 );
+					const uint32_t covered = ~outside & spanMask;
+
+					for ( uint32_t i = 0; i < RasterBlockSize; ++i )
+					{
+						if ( ( covered >> i ) & 1 )
+						{
+							const int64_t pixelE[ 3 ] = { rowE[ 0 ] + edges.a[ 0 ] * i, rowE[ 1 ] + edges.a[ 1 ] * i, rowE[ 2 ] + edges.a[ 2 ] * i };
+							pixelFunc( bx + static_cast<int32_t>( i ), y, pixelE );
+						}
+					}
+
+					for ( int32_t k = 0; k < 3; ++k )
+					{
+						lanes[ k ][ 0 ] = _mm_add_epi32( lanes[ k ][ 0 ], rowStep[ k ] );
+						lanes[ k ][ 1 ] = _mm_add_epi32( lanes[ k ][ 1 ], rowStep[ k ] );
+						rowE[ k ] += edges.b[ k ];
+					}
+				}
+				continue;
+			}
+#endif
 
-				const int32_t x0 = std::max( 0,										static_cast<int>( ssBox.min[ 0 ] ) );
-				const int32_t x1 = std::min( static_cast<int>( image.GetWidth() ),	static_cast<int>( ssBox.max[ 0 ] + 0.5 ) );
-				const int32_t y0 = std::max( 0,										static_cast<int>( ssBox.min[ 1 ] ) );
-				const int32_t y1 = std::min( static_cast<int>( image.GetHeight() ),	static_cast<int>( ssBox.max[ 1 ] + 0.5 ) );
+			for ( int32_t y = spanY0; y <= spanY1; ++y )
+			{
+				int64_t pixelE[ 3 ];
+				for ( int32_t k = 0; k < 3; ++k )
+				{
+					pixelE[ k ] = rowE[ k ] + edges.a[ k ] * ( spanX0 - bx );
+				}
 
-				for ( int32_t y = y0; y <= y1; ++y )
+				for ( int32_t x = spanX0; x <= spanX1; ++x )
 				{
-					for ( int32_t x = x0; x <= x1; ++x )
+					if ( accepted || ( ( pixelE[ 0 ] | pixelE[ 1 ] | pixelE[ 2 ] ) >= 0 ) )
 					{
-						const vec3d baryPt = PointToBarycentric( vec3d( x, y, 0.0 ), tPt0, tPt1, tPt2 );
+						pixelFunc( x, y, pixelE );
+					}
+					for ( int32_t k = 0; k < 3; ++k )
+					{
+						pixelE[ k ] += edges.a[ k ];
+					}
+				}
+
+				for ( int32_t k = 0; k < 3; ++k )
+				{
+					rowE[ k ] += edges.b[ k ];
+				}
+			}
+		}
+	}
+}
 
-						fragmentInput_t fragmentInput;
-						if( !EmitFragment( baryPt, vo, fragmentInput ) )
-							continue;
 
-						const float depth = (float)fragmentInput.clipPosition[ 2 ];
+// Pixels of one tile, indexed from the tile's corner
+struct tilePixels_t
+{
+	const rasterTri_t*	visible[ RasterTileSize * RasterTileSize ];	// Nearest triangle after a depth prepass
+	uint8_t				written[ RasterTileSize * RasterTileSize ];
+	vec2i				p0;
+	vec2i				p1;
 
-						if ( depth >= zBuffer.GetPixel( x, y ) )
-							continue;
+	uint32_t Index( const int32_t x, const int32_t y ) const
+	{
+		return ( y - p0[ 1 ] ) * RasterTileSize + ( x - p0[ 0 ] );
+	}
+};
 
-						const vec3d normal = fragmentInput.normal.Normalize();
 
-						const light_t& L = scene.lights[ 0 ];
-						const vec4d intensity = vec4d( L.intensity, 1.0f );
+// Shades each fragment that passes the depth test when it arrives, so overdrawn pixels are shaded repeatedly
+void RasterTileForward( Image<Color>& image, const SceneView& view, const std::vector<const rasterTri_t*>& triOrder, tilePixels_t& tile, rasterCounts_t& stats )
+{
+	for ( const rasterTri_t* tri : triOrder )
+	{
+		const rasterTri_t& rt = *tri;
+		const material_t& material = *rm.GetMaterialRef( rt.materialId );
 
-						vec3d lightDir = L.pos - Trunc<4, 1>( fragmentInput.wsPosition );
-						lightDir = lightDir.Normalize();
+		WalkTriangleInTile( rt, tile.p0, tile.p1, [&]( const int32_t x, const int32_t y, const int64_t e[ 3 ] )
+		{
+			++stats.fragments;
 
-						const vec3d viewVector = Trunc<4, 1>( view.camera.origin - fragmentInput.wsPosition ).Normalize();
-						const Color viewDiffuse = Color( (float)Dot( viewVector, normal ) );
+			const vec3d baryPt = EdgeBarycentrics( rt.edges, e );
+			const float depth = FragmentDepth( rt.vo, baryPt );
+			if ( depth >= zBuffer.GetPixel( x, y ) )
+			{
+				return;
+			}
+			++stats.depthPassed;
 
-						const vec3d halfVector = ( viewVector + lightDir ).Normalize();
+			fragmentInput_t fragmentInput;
+			EmitFragment( baryPt, rt.vo, fragmentInput );
 
-						Color surfaceColor = Color::Black;
+			image.SetPixel( x, y, LinearToSrgb( ShadeFragment( view, material, fragmentInput ) ).AsR8G8B8A8() );
+			zBuffer.SetPixel( x, y, depth );
+			tile.written[ tile.Index( x, y ) ] = 1;
+			++stats.shaded;
+		} );
+	}
+}
 
-						const material_t* material = rm.GetMaterialRef( triCache[ i ].materialId );
 
-						if( material->textured )
-						{
-							const Image<Color>* texture = rm.GetImageRef( material->colorMapId );
-							surfaceColor = texture->GetPixelUV( fragmentInput.uv[ 0 ], fragmentInput.uv[ 1 ] );
-						}
-						else
-						{
-							surfaceColor += fragmentInput.color;
-						}
+// Depth-only pass that leaves the nearest triangle of every pixel in a visibility buffer,
+// then interpolates and shades each covered pixel exactly once
+void RasterTileDeferred( Image<Color>& image, const SceneView& view, const std::vector<const rasterTri_t*>& triOrder, tilePixels_t& tile, rasterCounts_t& stats )
+{
+	for ( const rasterTri_t* tri : triOrder )
+	{
+		const rasterTri_t& rt = *tri;
+		WalkTriangleInTile( rt, tile.p0, tile.p1, [&]( const int32_t x, const int32_t y, const int64_t e[ 3 ] )
+		{
+			++stats.fragments;
 
-						const vec4d D = ColorToVector( Color( material->Kd ) );
-						const vec4d S = ColorToVector( Color( material->Ks ) );
+			const float depth = FragmentDepth( rt.vo, EdgeBarycentrics( rt.edges, e ) );
+			if ( depth >= zBuffer.GetPixel( x, y ) )
+			{
+				return;
+			}
+			++stats.depthPassed;
 
-						const vec4d diffuseIntensity = Multiply( D, intensity ) * std::max( 0.0, Dot( normal, lightDir ) );
-						const vec4d specularIntensity = S * pow( std::max( 0.0, Dot( normal, halfVector ) ), SpecularPower );
-						const Color ambient = AmbientLight * ( Color( material->Ka ) * surfaceColor );
+			zBuffer.SetPixel( x, y, depth );
+			tile.visible[ tile.Index( x, y ) ] = tri;
+			tile.written[ tile.Index( x, y ) ] = 1;
+		} );
+	}
 
-						Color shadingColor;
-						shadingColor += Vec4dToColor( specularIntensity );
-						shadingColor += Vec4dToColor( Multiply( diffuseIntensity, ColorToVector( surfaceColor ) ) );
-						shadingColor += ambient;
+	for ( int32_t y = tile.p0[ 1 ]; y < tile.p1[ 1 ]; ++y )
+	{
+		for ( int32_t x = tile.p0[ 0 ]; x < tile.p1[ 0 ]; ++x )
+		{
+			const uint32_t pixelIx = tile.Index( x, y );
+			if ( !tile.written[ pixelIx ] )
+			{
+				continue;
+			}
 
-						const Color normalColor = Vec3dToColor( 0.5 * normal + vec3d( 0.5 ) );
-						
-						image.SetPixel( x, y, LinearToSrgb( shadingColor ).AsR8G8B8A8() );
-						zBuffer.SetPixel( x, y, depth );
-					}
-				}
+			const rasterTri_t& rt = *tile.visible[ pixelIx ];
+			int64_t e[ 3 ];
+			for ( int32_t k = 0; k < 3; ++k )
+			{
+				e[ k ] = EdgeAt( rt.edges, k, x, y );
+			}
+
+			fragmentInput_t fragmentInput;
+			EmitFragment( EdgeBarycentrics( rt.edges, e ), rt.vo, fragmentInput );
+
+			const material_t& material = *rm.GetMaterialRef( rt.materialId );
+			image.SetPixel( x, y, LinearToSrgb( ShadeFragment( view, material, fragmentInput ) ).AsR8G8B8A8() );
+			++stats.shaded;
+		}
+	}
+}
+
+
+// Sort-middle rasterizer. Triangles are shaded and binned into RasterTileSize screen tiles in
+// parallel chunks, then every tile is rasterized by one worker. Tiles own disjoint pixels of
+// image and zBuffer, so neither needs a lock. A tile walks its bins in chunk order, so
+// triangles land in submission order and depth ties resolve as they would on one thread.
+void RasterSceneTiled( Image<Color>& image, const SceneView& view )
+{
+	const uint32_t instanceCnt = static_cast<uint32_t>( scene.instances.size() );
+
+	rasterStats_t stats;
+
+	// One triangle list per instance, then one for the tessellated primitives
+	const uint32_t sourceCnt = instanceCnt + 1;
+	std::vector<std::vector<uint32_t>> visibleTris( sourceCnt );
+	threadPool.ParallelFor( instanceCnt, [&]( const uint32_t instanceIx, const uint32_t workerIx )
+	{
+		rasterCounts_t counts = {};
+		GatherVisibleTriangles( view, scene.instances[ instanceIx ], visibleTris[ instanceIx ], counts );
+		stats.Add( counts );
+	} );
+
+	{
+		rasterCounts_t counts = {};
+		GatherVisiblePrimitiveTriangles( view, visibleTris[ instanceCnt ], counts );
+		stats.Add( counts );
+	}
+
+	std::vector<uint32_t> firstTri( sourceCnt + 1, 0 );
+	for ( uint32_t sourceIx = 0; sourceIx < sourceCnt; ++sourceIx )
+	{
+		firstTri[ sourceIx + 1 ] = firstTri[ sourceIx ] + static_cast<uint32_t>( visibleTris[ sourceIx ].size() );
+	}
+	const uint32_t triCnt = firstTri[ sourceCnt ];
+
+	const int32_t width = static_cast<int32_t>( std::min( image.GetWidth(), zBuffer.GetWidth() ) );
+	const int32_t height = static_cast<int32_t>( std::min( image.GetHeight(), zBuffer.GetHeight() ) );
+	const uint32_t tilesX = ( width + RasterTileSize - 1 ) / RasterTileSize;
+	const uint32_t tilesY = ( height + RasterTileSize - 1 ) / RasterTileSize;
+	const uint32_t tileCnt = tilesX * tilesY;
+	const uint32_t chunkCnt = ( triCnt + RasterChunkSize - 1 ) / RasterChunkSize;
+
+	std::vector<std::vector<rasterTri_t>> chunkTris( chunkCnt );		// Clipping may emit several per scene triangle
+	std::vector<std::vector<uint32_t>> bins( chunkCnt * tileCnt );	// chunkIx * tileCnt + tileIx, indexing chunkTris[ chunkIx ]
+
+	threadPool.ParallelFor( chunkCnt, [&]( const uint32_t chunkIx, const uint32_t workerIx )
+	{
+		const uint32_t first = chunkIx * RasterChunkSize;
+		const uint32_t last = std::min( first + RasterChunkSize, triCnt );
+		rasterCounts_t counts = {};
+
+		uint32_t sourceIx = static_cast<uint32_t>( std::upper_bound( firstTri.begin(), firstTri.end(), first ) - firstTri.begin() ) - 1;
+		for ( uint32_t triIx = first; triIx < last; ++triIx )
+		{
+			while ( triIx >= firstTri[ sourceIx + 1 ] )
+			{
+				++sourceIx;
+			}
+
+			const uint32_t sourceTriIx = visibleTris[ sourceIx ][ triIx - firstTri[ sourceIx ] ];
+			const bool isPrimitive = ( sourceIx == instanceCnt );
+			const Triangle tri = isPrimitive ? scene.primitiveTris[ sourceTriIx ] : GetInstanceTriangle( scene.instances[ sourceIx ], scene.models[ scene.instances[ sourceIx ].meshIx ].triCache[ sourceTriIx ] );
+
+#if USE_BACKFACE_CULL
+			const windingOrder_t winding = isPrimitive ? WINDING_CCW : scene.instances[ sourceIx ].winding;
+			if ( IsBackface( view, winding, tri ) )
+			{
+				++counts.backfacesCulled;
+				continue;
 			}
-			else
 #endif
+
+			vertexOut_t clipped[ MaxClippedTris ];
+			const uint32_t clippedCnt = VertexShader( view, tri, clipped );
+			if ( clippedCnt == 0 )
+			{
+				++counts.clippedAway;
+				continue;
+			}
+
+			for ( uint32_t clippedIx = 0; clippedIx < clippedCnt; ++clippedIx )
 			{
-				Color color = vo.color[ 0 ];
-				color.rgba().a = 0.1f;
+				rasterTri_t rt;
+				rt.vo = clipped[ clippedIx ];
+
+				AABB ssBox;
+				for ( int i = 0; i < 3; ++i )
+				{
+					ssBox.Expand( Trunc<4, 1>( rt.vo.clipPosition[ i ] ) );
+				}
 
-				vec2i pxPts[ 3 ];
-				pxPts[ 0 ] = vec2i( static_cast<int32_t>( vo.clipPosition[ 0 ][ 0 ] ), static_cast<int32_t>( vo.clipPosition[ 0 ][ 1 ] ) );
-				pxPts[ 1 ] = vec2i( static_cast<int32_t>( vo.clipPosition[ 1 ][ 0 ] ), static_cast<int32_t>( vo.clipPosition[ 1 ][ 1 ] ) );
-				pxPts[ 2 ] = vec2i( static_cast<int32_t>( vo.clipPosition[ 2 ][ 0 ] ), static_cast<int32_t>( vo.clipPosition[ 2 ][ 1 ] ) );
+				rt.x0 = std::max( 0,			static_cast<int>( ssBox.min[ 0 ] ) );
+				rt.x1 = std::min( width - 1,	static_cast<int>( ssBox.max[ 0 ] + 0.5 ) );
+				rt.y0 = std::max( 0,			static_cast<int>( ssBox.min[ 1 ] ) );
+				rt.y1 = std::min( height - 1,	static_cast<int>( ssBox.max[ 1 ] + 0.5 ) );
+				rt.materialId = tri.materialId;
 
-				DrawLine( image, pxPts[ 0 ][ 0 ], pxPts[ 0 ][ 1 ], pxPts[ 1 ][ 0 ], pxPts[ 1 ][ 1 ], color );
-				DrawLine( image, pxPts[ 0 ][ 0 ], pxPts[ 0 ][ 1 ], pxPts[ 2 ][ 0 ], pxPts[ 2 ][ 1 ], color );
-				DrawLine( image, pxPts[ 1 ][ 0 ], pxPts[ 1 ][ 1 ], pxPts[ 2 ][ 0 ], pxPts[ 2 ][ 1 ], color );
+				if ( ( rt.x0 > rt.x1 ) || ( rt.y0 > rt.y1 ) || !SetupEdges( rt.vo, rt.edges ) )
+				{
+					continue;
+				}
+
+				const uint32_t localIx = static_cast<uint32_t>( chunkTris[ chunkIx ].size() );
+				chunkTris[ chunkIx ].push_back( rt );
+
+				for ( uint32_t ty = rt.y0 / RasterTileSize; ty <= rt.y1 / RasterTileSize; ++ty )
+				{
+					for ( uint32_t tx = rt.x0 / RasterTileSize; tx <= rt.x1 / RasterTileSize; ++tx )
+					{
+						bins[ chunkIx * tileCnt + ty * tilesX + tx ].push_back( localIx );
+					}
+				}
 			}
 		}
+		stats.Add( counts );
+	} );
+
+	threadPool.ParallelFor( tileCnt, [&]( const uint32_t tileIx, const uint32_t workerIx )
+	{
+		const int32_t px = ( tileIx % tilesX ) * RasterTileSize;
+		const int32_t py = ( tileIx / tilesX ) * RasterTileSize;
+
+		std::unique_ptr<tilePixels_t> tile( new tilePixels_t );
+		tile->p0 = vec2i( px, py );
+		tile->p1 = vec2i( std::min( px + static_cast<int32_t>( RasterTileSize ), width ), std::min( py + static_cast<int32_t>( RasterTileSize ), height ) );
+		memset( tile->written, 0, sizeof( tile->written ) );
+
+		std::vector<const rasterTri_t*> triOrder;
+		for ( uint32_t chunkIx = 0; chunkIx < chunkCnt; ++chunkIx )
+		{
+			for ( const uint32_t localIx : bins[ chunkIx * tileCnt + tileIx ] )
+			{
+				triOrder.push_back( &chunkTris[ chunkIx ][ localIx ] );
+			}
+		}
+
+		rasterCounts_t counts = {};
+#if USE_DEPTH_PREPASS
+		RasterTileDeferred( image, view, triOrder, *tile, counts );
+#else
+		RasterTileForward( image, view, triOrder, *tile, counts );
+#endif
+		for ( const uint8_t written : tile->written )
+		{
+			counts.pixels += written;
+		}
+		stats.Add( counts );
+	} );
+
+	const uint64_t pixels = std::max<uint64_t>( 1, stats.pixels );
+	std::cout << "\nRaster: " << stats.fragments << " fragments, " << stats.depthPassed << " passed depth, "
+		<< stats.shaded << " shaded over " << stats.pixels << " pixels (overdraw "
+		<< stats.depthPassed / static_cast<double>( pixels ) << "x, shading " << stats.shaded / static_cast<double>( pixels ) << "x)" << std::endl;
+	std::cout << "Culled: " << stats.instancesCulled << " instances and primitives, " << stats.nodesCulled << " BVH nodes (" << stats.nodeTrisCulled << " triangles), "
+		<< stats.backfacesCulled << " back faces, " << stats.clippedAway << " outside the frustum" << std::endl;
+}
+
+
+void DrawTriangleWire( Image<Color>& image, const SceneView& view, const Triangle& tri )
+{
+	vertexOut_t clipped[ MaxClippedTris ];
+	const uint32_t clippedCnt = VertexShader( view, tri, clipped );
+	for ( uint32_t clippedIx = 0; clippedIx < clippedCnt; ++clippedIx )
+	{
+		const vertexOut_t& vo = clipped[ clippedIx ];
+
+		Color color = vo.color[ 0 ];
+		color.rgba().a = 0.1f;
+
+		vec2i pxPts[ 3 ];
+		pxPts[ 0 ] = vec2i( static_cast<int32_t>( vo.clipPosition[ 0 ][ 0 ] ), static_cast<int32_t>( vo.clipPosition[ 0 ][ 1 ] ) );
+		pxPts[ 1 ] = vec2i( static_cast<int32_t>( vo.clipPosition[ 1 ][ 0 ] ), static_cast<int32_t>( vo.clipPosition[ 1 ][ 1 ] ) );
+		pxPts[ 2 ] = vec2i( static_cast<int32_t>( vo.clipPosition[ 2 ][ 0 ] ), static_cast<int32_t>( vo.clipPosition[ 2 ][ 1 ] ) );
+
+		DrawLine( image, pxPts[ 0 ][ 0 ], pxPts[ 0 ][ 1 ], pxPts[ 1 ][ 0 ], pxPts[ 1 ][ 1 ], color );
+		DrawLine( image, pxPts[ 0 ][ 0 ], pxPts[ 0 ][ 1 ], pxPts[ 2 ][ 0 ], pxPts[ 2 ][ 1 ], color );
+		DrawLine( image, pxPts[ 1 ][ 0 ], pxPts[ 1 ][ 1 ], pxPts[ 2 ][ 0 ], pxPts[ 2 ][ 1 ], color );
+	}
+}
+
+
+void RasterScene( Image<Color>& image, const SceneView& view, bool wireFrame = true )
+{
+	const uint32_t instanceCnt = static_cast<uint32_t>( scene.instances.size() );
+
+#if USE_RASTERIZE
+	if ( !wireFrame )
+	{
+		RasterSceneTiled( image, view );
+		return;
+	}
+#endif
+
+#if DRAW_WIREFRAME
+	for ( uint32_t instanceIx = 0; instanceIx < instanceCnt; ++instanceIx )
+	{
+		const instance_t& instance = scene.instances[ instanceIx ];
+		const ModelInstance& model = scene.models[ instance.meshIx ];
+		const Triangle* triCache = model.triCache.data();
+
+		// Wireframes show back faces, so only the frustum culls apply
+		std::vector<uint32_t> visibleTris;
+		rasterCounts_t counts = {};
+		GatherVisibleTriangles( view, instance, visibleTris, counts );
+
+		for ( const uint32_t triIx : visibleTris )
+		{
+			DrawTriangleWire( image, view, GetInstanceTriangle( instance, triCache[ triIx ] ) );
+		}
+	}
+
+	std::vector<uint32_t> visiblePrimTris;
+	rasterCounts_t primCounts = {};
+	GatherVisiblePrimitiveTriangles( view, visiblePrimTris, primCounts );
+	for ( const uint32_t triIx : visiblePrimTris )
+	{
+		DrawTriangleWire( image, view, scene.primitiveTris[ triIx ] );
 	}
 #endif
 
 	if ( wireFrame )
 	{
-		for ( uint32_t m = 0; m < modelCnt; ++m )
+		for ( uint32_t instanceIx = 0; instanceIx < instanceCnt; ++instanceIx )
 		{
-			const ModelInstance& model = scene.models[ m ];
+			const instance_t& instance = scene.instances[ instanceIx ];
 #if DRAW_AABB
-			const AABB bounds = model.octree.GetAABB();
+			const AABB& bounds = instance.bounds;
 			DrawCube( image, view, vec4d( bounds.min, 1.0 ), vec4d( bounds.max, 1.0 ) );
 			DrawCube( image, view, vec4d( bounds.min, 1.0 ), vec4d( bounds.max, 1.0 ) );
 #endif
@@ -381,10 +1140,18 @@ void RasterScene( Image<Color>& image, const SceneView& view, bool wireFrame = t
 			vec3d xAxis;
 			vec3d yAxis;
 			vec3d zAxis;
-			OrthoMatrixToAxis( model.transform, origin, xAxis, yAxis, zAxis );
+			OrthoMatrixToAxis( instance.transform, origin, xAxis, yAxis, zAxis );
 			DrawWorldAxis( image, view, 20.0, origin, xAxis, yAxis, zAxis );
 		}
+
+#if DRAW_AABB
+		for ( const primitive_t& prim : scene.primitives )
+		{
+			const AABB bounds = PrimitiveBounds( prim );
+			DrawCube( image, view, vec4d( bounds.min, 1.0 ), vec4d( bounds.max, 1.0 ) );
+		}
+#endif
 	}
 	
-	// DrawOctree( image, view, scene.models[ 0 ].octree, Color::Red );
+	// DrawBVH( image, view, scene.blas[ 0 ], Color::Red );
 }
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "sampler.h"
+
+static const uint32_t SobolDimCnt = 8;
+static const uint32_t SobolBitCnt = 32;
+static const uint32_t HaltonDimCnt = 16;
+static const uint32_t HaltonPrimes[ HaltonDimCnt ] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+static const double UnitScale = 1.0 / 4294967296.0; // 2^-32
+
+
+// Avalanching integer hash (lowbias32)
+static inline uint32_t Hash( uint32_t x )
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+
+static inline uint32_t HashCombine( const uint32_t seed, const uint32_t value )
+{
+	return Hash( seed ^ ( value + 0x9e3779b9u + ( seed << 6 ) + ( seed >> 2 ) ) );
+}
+
+
+static inline uint32_t ReverseBits( uint32_t x )
+{
+	x = ( ( x >> 1 ) & 0x55555555u ) | ( ( x & 0x55555555u ) << 1 );
+	x = ( ( x >> 2 ) & 0x33333333u ) | ( ( x & 0x33333333u ) << 2 );
+	x = ( ( x >> 4 ) & 0x0f0f0f0fu ) | ( ( x & 0x0f0f0f0fu ) << 4 );
+	x = ( ( x >> 8 ) & 0x00ff00ffu ) | ( ( x & 0x00ff00ffu ) << 8 );
+	return ( x >> 16 ) | ( x << 16 );
+}
+
+
+// Owen scrambling of the bit-reversed value: every bit is flipped by a hash of the bits above it.
+// Laine and Karras, "Stratified Sampling for Stochastic Transparency", with Burley's constants.
+static inline uint32_t NestedUniformScramble( uint32_t x, const uint32_t seed )
+{
+	x = ReverseBits( x );
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return ReverseBits( x );
+}
+
+
+// Direction numbers for the first SobolDimCnt dimensions (Joe and Kuo, new-joe-kuo-6.21201)
+struct sobolTable_t
+{
+	uint32_t directions[ SobolDimCnt ][ SobolBitCnt ];
+
+	sobolTable_t()
+	{
+		struct primitive_t
+		{
+			uint32_t degree;
+			uint32_t coefficients;
+			uint32_t m[ 5 ];
+		};
+
+		static const primitive_t polys[ SobolDimCnt - 1 ] =
+		{
+			{ 1, 0, { 1 } },
+			{ 2, 1, { 1, 3 } },
+			{ 3, 1, { 1, 3, 1 } },
+			{ 3, 2, { 1, 1, 1 } },
+			{ 4, 1, { 1, 1, 3, 3 } },
+			{ 4, 4, { 1, 3, 5, 13 } },
+			{ 5, 2, { 1, 1, 5, 5, 17 } },
+		};
+
+		// First dimension is the van der Corput sequence
+		for ( uint32_t k = 0; k < SobolBitCnt; ++k )
+		{
+			directions[ 0 ][ k ] = 1u << ( SobolBitCnt - 1 - k );
+		}
+
+		for ( uint32_t dim = 1; dim < SobolDimCnt; ++dim )
+		{
+			const primitive_t& poly = polys[ dim - 1 ];
+			uint32_t* v = directions[ dim ];
+			const uint32_t s = poly.degree;
+
+			for ( uint32_t k = 0; k < s; ++k )
+			{
+				v[ k ] = poly.m[ k ] << ( SobolBitCnt - 1 - k );
+			}
+
+			for ( uint32_t k = s; k < SobolBitCnt; ++k )
+			{
+				v[ k ] = v[ k - s ] ^ ( v[ k - s ] >> s );
+				for ( uint32_t j = 1; j < s; ++j )
+				{
+					v[ k ] ^= ( ( poly.coefficients >> ( s - 1 - j ) ) & 1u ) * v[ k - j ];
+				}
+			}
+		}
+	}
+};
+
+static const sobolTable_t SobolTable;
+
+
+static inline uint32_t SobolSample( uint32_t index, const uint32_t dim )
+{
+	uint32_t x = 0;
+	for ( uint32_t k = 0; index != 0; ++k, index >>= 1 )
+	{
+		x ^= ( index & 1u ) * SobolTable.directions[ dim ][ k ];
+	}
+	return x;
+}
+
+
+static double RadicalInverse( const uint32_t base, uint32_t index )
+{
+	const double invBase = 1.0 / base;
+	double scale = invBase;
+	double result = 0.0;
+	while ( index > 0 )
+	{
+		result += ( index % base ) * scale;
+		index /= base;
+		scale *= invBase;
+	}
+	return result;
+}
+
+
+static double SampleRandom( const sampler_t& sampler, const uint32_t dimension )
+{
+	const uint32_t h = HashCombine( HashCombine( Hash( sampler.pixelIx ), sampler.sampleIx ), dimension );
+	return h * UnitScale;
+}
+
+
+// Dimensions past the prime table reuse the bases under a different rotation
+static double SampleHalton( const sampler_t& sampler, const uint32_t dimension )
+{
+	const double x = RadicalInverse( HaltonPrimes[ dimension % HaltonDimCnt ], sampler.sampleIx );
+	const double rotation = HashCombine( Hash( sampler.pixelIx ), dimension ) * UnitScale;
+	const double rotated = x + rotation;
+	return ( rotated < 1.0 ) ? rotated : ( rotated - 1.0 );
+}
+
+
+// Dimensions are padded in groups of SobolDimCnt. Each group shuffles the sample index on its own,
+// which keeps the points stratified within a group and decorrelated between groups and pixels.
+static double SampleSobol( const sampler_t& sampler, const uint32_t dimension )
+{
+	const uint32_t dim = dimension % SobolDimCnt;
+	const uint32_t seed = HashCombine( Hash( sampler.pixelIx ), dimension / SobolDimCnt );
+
+	const uint32_t index = NestedUniformScramble( sampler.sampleIx, seed );
+	const uint32_t x = NestedUniformScramble( SobolSample( index, dim ), HashCombine( seed, dim ) );
+	return x * UnitScale;
+}
+
+
+double Sample1D( const sampler_t& sampler, const uint32_t dimension )
+{
+	switch ( sampler.type )
+	{
+	case SAMPLER_HALTON:	return SampleHalton( sampler, dimension );
+	case SAMPLER_SOBOL:		return SampleSobol( sampler, dimension );
+	default:
+	case SAMPLER_RANDOM:	return SampleRandom( sampler, dimension );
+	}
+}
+
+
+vec2d Sample2D( const sampler_t& sampler, const uint32_t dimension )
+{
+	return vec2d( Sample1D( sampler, dimension ), Sample1D( sampler, dimension + 1 ) );
+}
+
+
+vec2d SampleCircle( const sampler_t& sampler, const uint32_t dimension )
+{
+	const double a = Sample1D( sampler, dimension ) * 6.2831853;
+	return vec2d( cos( a ), sin( a ) );
+}
+
+
+vec3d SampleCube( const sampler_t& sampler, const uint32_t dimension, const double scale )
+{
+	return scale * vec3d(	Sample1D( sampler, dimension ) * 2.0 - 1.0,
+							Sample1D( sampler, dimension + 1 ) * 2.0 - 1.0,
+							Sample1D( sampler, dimension + 2 ) * 2.0 - 1.0 );
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include "../GfxCore/mathVector.h"
+
+enum samplerType_t : uint32_t
+{
+	SAMPLER_RANDOM,	// Counter-based hash of ( pixel, sample, dimension )
+	SAMPLER_HALTON,	// Radical inverse in prime bases, rotated per pixel
+	SAMPLER_SOBOL,	// Owen-scrambled Sobol, index shuffled per pixel
+};
+
+// Dimension layout of one path. Each bounce draws SampleDimsPerBounce values after SampleDimBounce.
+static const uint32_t SampleDimPixel		= 0;	// 2D sub-pixel offset
+static const uint32_t SampleDimLens			= 2;	// 2D point on the aperture
+static const uint32_t SampleDimBounce		= 4;	// 3D reflection jitter
+static const uint32_t SampleDimsPerBounce	= 3;
+
+// Stateless sample stream for one subsample of one pixel. A value depends only on
+// ( pixelIx, sampleIx, dimension ), never on the thread that draws it or the order of draws.
+struct sampler_t
+{
+	samplerType_t	type;
+	uint32_t		pixelIx;
+	uint32_t		sampleIx;
+};
+
+
+inline sampler_t MakeSampler( const samplerType_t type, const uint32_t pixelIx, const uint32_t sampleIx )
+{
+	sampler_t sampler;
+	sampler.type = type;
+	sampler.pixelIx = pixelIx;
+	sampler.sampleIx = sampleIx;
+	return sampler;
+}
+
+
+inline uint32_t BounceDimension( const uint32_t rayDepth )
+{
+	return SampleDimBounce + rayDepth * SampleDimsPerBounce;
+}
+
+
+// Value in [0, 1) for one dimension of the stream
+double Sample1D( const sampler_t& sampler, const uint32_t dimension );
+
+// Dimensions dimension and dimension + 1
+vec2d Sample2D( const sampler_t& sampler, const uint32_t dimension );
+
+// Point on the unit circle from one dimension
+vec2d SampleCircle( const sampler_t& sampler, const uint32_t dimension );
+
+// Point in the cube [-scale, scale]^3 from three dimensions
+vec3d SampleCube( const sampler_t& sampler, const uint32_t dimension, const double scale );
@@ -6,6 +6,11 @@
 #include "../GfxCore/camera.h"
 #include "../GfxCore/color.h"
 #include "../GfxCore/geom.h"
+#include "../GfxCore/resourceManager.h"
+#include "bvh.h"
+#include "triSoA.h"
+#include "lightTree.h"
+#include "primitive.h"
 
 struct light_t
 {
@@ -14,15 +19,97 @@ struct light_t
 	Color	color;
 };
 
+// Marks an instance that keeps its mesh materials. Compared with != so it holds whether matHdl_t is signed or not.
+static const matHdl_t InvalidMaterialHdl = static_cast<matHdl_t>( -1 );
+
+// Vertex order of a front face, seen from in front of it
+enum windingOrder_t : uint32_t
+{
+	WINDING_CCW,
+	WINDING_CW,
+};
+
+
+// Placement of a shared object-space mesh. Color and material are applied per instance
+// so every copy of a model can reference the same mesh and trees.
+struct instance_t
+{
+	mat4x4d		transform;		// Object to world
+	mat4x4d		invTransform;	// World to object
+	AABB		bounds;			// World space
+	uint32_t	meshIx;			// Index into Scene::models, blas and triSoA
+	Color		color;
+	matHdl_t	materialId;		// Replaces the mesh materials unless InvalidMaterialHdl
+	windingOrder_t	winding;	// Of world-space triangles; a mirroring transform reverses the model's
+};
+
+
 class Scene
 {
 public:
-	std::vector<ModelInstance>	models;
+	std::vector<ModelInstance>	models;		// Unique object-space meshes
+	std::vector<instance_t>		instances;
+	std::vector<BVH<real_t>>	blas;	// Triangle tree per mesh, indexed like models
+	std::vector<triSoA_t<real_t>>	triSoA;	// Intersection data in blas leaf order, indexed like models
+	std::vector<primitive_t>	primitives;	// Analytic surfaces, traced without a mesh or BLAS
+	std::vector<Triangle>		primitiveTris;	// World-space tessellation of primitives, only drawn by the rasterizer
+	std::vector<uint32_t>		primitiveFirstTri;	// Start of each primitive's run in primitiveTris, then one past the last
 	std::vector<light_t>		lights;
-	AABB						aabb;	// TODO: Replace with bvh tree
+	LightTree					lightTree;	// Built over lights once there are more than ExhaustiveLightCnt
+	AABB						aabb;
+	BVH<real_t>					tlas;	// Top-level tree over instance bounds, then primitive bounds
 };
 
 
+// TLAS leaves and hit records index instances first and primitives after them
+inline bool IsPrimitiveObject( const Scene& scene, const uint32_t objectIx )
+{
+	return objectIx >= scene.instances.size();
+}
+
+
+inline const primitive_t& GetPrimitiveObject( const Scene& scene, const uint32_t objectIx )
+{
+	return scene.primitives[ objectIx - scene.instances.size() ];
+}
+
+
+inline matHdl_t GetInstanceMaterial( const instance_t& instance, const Triangle& tri )
+{
+	return ( instance.materialId != InvalidMaterialHdl ) ? instance.materialId : tri.materialId;
+}
+
+
+// Normals go through the inverse transpose so they stay perpendicular under non-uniform scale
+inline vec3d TransformNormal( const instance_t& instance, const vec3d& normal )
+{
+	const mat4x4d& inv = instance.invTransform;
+	vec3d n;
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		n[ i ] = inv[ 0 ][ i ] * normal[ 0 ] + inv[ 1 ][ i ] * normal[ 1 ] + inv[ 2 ][ i ] * normal[ 2 ];
+	}
+	return n.Normalize();
+}
+
+
+// World-space copy of a mesh triangle, for code that consumes whole triangles such as the rasterizer
+inline Triangle GetInstanceTriangle( const instance_t& instance, const Triangle& tri )
+{
+	Triangle wsTri = tri;
+	vertex_t* verts[ 3 ] = { &wsTri.v0, &wsTri.v1, &wsTri.v2 };
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		verts[ i ]->pos = instance.transform * verts[ i ]->pos;
+		verts[ i ]->normal = TransformNormal( instance, verts[ i ]->normal );
+		verts[ i ]->color = instance.color;
+	}
+	wsTri.n = TransformNormal( instance, tri.n );
+	wsTri.materialId = GetInstanceMaterial( instance, tri );
+	return wsTri;
+}
+
+
 class SceneView
 {
 public:
@@ -30,6 +117,7 @@ public:
 	mat4x4d		viewTransform;
 	mat4x4d		projTransform;
 	mat4x4d		projView;
+	mat4x4d		prevProjView;	// projView of the previous frame, for motion vectors
 	vec2i		targetSize;
 	blendMode_t	blendMode;
 };
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "simd.h"
+
+#if defined( _MSC_VER )
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+simdLevel_t DetectSimdLevel()
+{
+#if defined( _MSC_VER )
+	int32_t info[ 4 ];
+	__cpuid( info, 0 );
+	if ( info[ 0 ] < 7 )
+	{
+		return SIMD_SSE;
+	}
+
+	__cpuid( info, 1 );
+	const bool osxsave = ( info[ 2 ] & ( 1 << 27 ) ) != 0;
+	if ( !osxsave )
+	{
+		return SIMD_SSE;
+	}
+
+	// The OS has to save the wider register state on context switches
+	const uint64_t xcr0 = _xgetbv( 0 );
+	const bool ymmEnabled = ( xcr0 & 0x06 ) == 0x06;
+	const bool zmmEnabled = ( xcr0 & 0xE6 ) == 0xE6;
+
+	__cpuid( info, 7 );
+	const bool avx2 = ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+	const bool avx512f = ( info[ 1 ] & ( 1 << 16 ) ) != 0;
+
+	if ( avx512f && zmmEnabled )
+	{
+		return SIMD_AVX512;
+	}
+	if ( avx2 && ymmEnabled )
+	{
+		return SIMD_AVX2;
+	}
+	return SIMD_SSE;
+#elif defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx512f" ) )
+	{
+		return SIMD_AVX512;
+	}
+	if ( __builtin_cpu_supports( "avx2" ) )
+	{
+		return SIMD_AVX2;
+	}
+	return SIMD_SSE;
+#else
+	return SIMD_SSE;
+#endif
+}
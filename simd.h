@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+enum simdLevel_t : uint32_t
+{
+	SIMD_SSE,
+	SIMD_AVX2,
+	SIMD_AVX512,
+};
+
+// Highest vector instruction set supported by both the CPU and the OS
+simdLevel_t DetectSimdLevel();
+
+// Rays per packet: one lane per element of type T in the widest register, so double packets
+// hold 2, 4 or 8 rays and float packets 4, 8 or 16
+template<typename T>
+inline uint32_t PacketWidth( const simdLevel_t level )
+{
+	static_assert( ( sizeof( T ) == 4 ) || ( sizeof( T ) == 8 ), "Packet lanes are float or double" );
+	switch ( level )
+	{
+	case SIMD_AVX512:	return 64 / sizeof( T );
+	case SIMD_AVX2:		return 32 / sizeof( T );
+	default:
+	case SIMD_SSE:		return 16 / sizeof( T );
+	}
+}
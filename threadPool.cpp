@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <chrono>
+#include "threadPool.h"
+
+ThreadPool::ThreadPool( const uint32_t threadCnt ) :
+	workerCnt( ( threadCnt > 0 ) ? threadCnt : std::max( 1u, std::thread::hardware_concurrency() ) ),
+	queues( workerCnt ),
+	job( nullptr ),
+	jobId( 0 ),
+	workersActive( 0 ),
+	shutdown( false ),
+	tasksDone( 0 )
+{
+	for ( uint32_t i = 0; i < workerCnt; ++i )
+	{
+		queues[ i ].begin = 0;
+		queues[ i ].end = 0;
+	}
+
+	threads.reserve( workerCnt );
+	for ( uint32_t i = 0; i < workerCnt; ++i )
+	{
+		threads.push_back( std::thread( &ThreadPool::WorkerLoop, this, i ) );
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock( jobLock );
+		shutdown = true;
+	}
+	jobStart.notify_all();
+
+	for ( auto& thread : threads )
+	{
+		thread.join();
+	}
+}
+
+
+void ThreadPool::ParallelFor( const uint32_t taskCnt, const task_t& task, const progress_t& progress )
+{
+	if ( taskCnt == 0 )
+	{
+		return;
+	}
+
+	// Contiguous ranges keep neighboring tasks on the same worker until stealing kicks in
+	for ( uint32_t i = 0; i < workerCnt; ++i )
+	{
+		std::lock_guard<std::mutex> lock( queues[ i ].lock );
+		queues[ i ].begin = static_cast<uint32_t>( ( static_cast<uint64_t>( taskCnt ) * i ) / workerCnt );
+		queues[ i ].end = static_cast<uint32_t>( ( static_cast<uint64_t>( taskCnt ) * ( i + 1 ) ) / workerCnt );
+	}
+
+	std::unique_lock<std::mutex> lock( jobLock );
+	job = &task;
+	tasksDone = 0;
+	workersActive = workerCnt;
+	++jobId;
+	jobStart.notify_all();
+
+	uint32_t lastReported = ~0u;
+	while ( workersActive > 0 )
+	{
+		if ( !progress )
+		{
+			jobDone.wait( lock, [&]() { return workersActive == 0; } );
+			break;
+		}
+
+		jobDone.wait_for( lock, std::chrono::milliseconds( 100 ) );
+
+		const uint32_t done = tasksDone;
+		if ( done != lastReported )
+		{
+			progress( done, taskCnt );
+			lastReported = done;
+		}
+	}
+	job = nullptr;
+}
+
+
+void ThreadPool::WorkerLoop( const uint32_t workerIx )
+{
+	uint32_t lastJobId = 0;
+	while ( true )
+	{
+		const task_t* currentJob = nullptr;
+		{
+			std::unique_lock<std::mutex> lock( jobLock );
+			jobStart.wait( lock, [&]() { return shutdown || ( jobId != lastJobId ); } );
+			if ( shutdown )
+			{
+				return;
+			}
+			lastJobId = jobId;
+			currentJob = job;
+		}
+
+		uint32_t taskIx;
+		while ( PopTask( workerIx, taskIx ) || StealTask( workerIx, taskIx ) )
+		{
+			( *currentJob )( taskIx, workerIx );
+			++tasksDone;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock( jobLock );
+			--workersActive;
+		}
+		jobDone.notify_all();
+	}
+}
+
+
+bool ThreadPool::PopTask( const uint32_t workerIx, uint32_t& taskIx )
+{
+	workQueue_t& queue = queues[ workerIx ];
+	std::lock_guard<std::mutex> lock( queue.lock );
+	if ( queue.begin >= queue.end )
+	{
+		return false;
+	}
+	taskIx = queue.begin++;
+	return true;
+}
+
+
+bool ThreadPool::StealTask( const uint32_t workerIx, uint32_t& taskIx )
+{
+	for ( uint32_t i = 1; i < workerCnt; ++i )
+	{
+		workQueue_t& victim = queues[ ( workerIx + i ) % workerCnt ];
+
+		uint32_t stolenBegin;
+		uint32_t stolenEnd;
+		{
+			std::lock_guard<std::mutex> lock( victim.lock );
+			if ( victim.begin >= victim.end )
+			{
+				continue;
+			}
+			const uint32_t remaining = victim.end - victim.begin;
+
+			// Take the back half; the victim keeps working from the front
+			stolenEnd = victim.end;
+			stolenBegin = victim.end - ( ( remaining + 1 ) / 2 );
+			victim.end = stolenBegin;
+		}
+
+		taskIx = stolenBegin;
+		if ( ( stolenBegin + 1 ) < stolenEnd )
+		{
+			workQueue_t& queue = queues[ workerIx ];
+			std::lock_guard<std::mutex> lock( queue.lock );
+			queue.begin = stolenBegin + 1;
+			queue.end = stolenEnd;
+		}
+		return true;
+	}
+	return false;
+}
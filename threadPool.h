@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include "alignedAllocator.h"
+
+// Persistent worker pool. ParallelFor splits the task range evenly across workers;
+// a worker that runs dry steals the back half of another worker's remaining range.
+class ThreadPool
+{
+public:
+	typedef std::function<void( const uint32_t taskIx, const uint32_t workerIx )>	task_t;
+	typedef std::function<void( const uint32_t tasksDone, const uint32_t taskCnt )>	progress_t;
+
+	// Zero uses one worker per hardware thread
+	explicit ThreadPool( const uint32_t threadCnt = 0 );
+	~ThreadPool();
+
+	ThreadPool( const ThreadPool& ) = delete;
+	ThreadPool& operator=( const ThreadPool& ) = delete;
+
+	uint32_t GetWorkerCount() const
+	{
+		return workerCnt;
+	}
+
+	// Blocks until every task has run. progress is called on the calling thread while waiting.
+	void ParallelFor( const uint32_t taskCnt, const task_t& task, const progress_t& progress = nullptr );
+
+private:
+	struct alignas( CacheLineSize ) workQueue_t
+	{
+		std::mutex	lock;
+		uint32_t	begin;
+		uint32_t	end;
+	};
+
+	void	WorkerLoop( const uint32_t workerIx );
+	bool	PopTask( const uint32_t workerIx, uint32_t& taskIx );
+	bool	StealTask( const uint32_t workerIx, uint32_t& taskIx );
+
+	uint32_t													workerCnt;
+	std::vector<std::thread>									threads;
+	std::vector<workQueue_t, AlignedAllocator<workQueue_t>>		queues;
+
+	std::mutex					jobLock;
+	std::condition_variable		jobStart;
+	std::condition_variable		jobDone;
+	const task_t*				job;
+	uint32_t					jobId;
+	uint32_t					workersActive;
+	bool						shutdown;
+	std::atomic<uint32_t>		tasksDone;
+};
@@ -28,6 +28,12 @@ public:
 		return ( endTimeMs - startTimeMs ).count();
 	}
 
+	// Time since Start() without stopping, safe to poll from several threads
+	double GetElapsedSinceStart() const
+	{
+		return ( duration_cast<milliseconds>( system_clock::now().time_since_epoch() ) - startTimeMs ).count();
+	}
+
 private:
 	milliseconds startTimeMs;
 	milliseconds endTimeMs;
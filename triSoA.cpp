@@ -0,0 +1,73 @@
+#include "triSoA.h"
+
+template<typename T>
+static void SetBlockLane( triBlock_t<T>& block, const uint32_t lane, const Triangle& tri, const uint32_t triIx )
+{
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		block.v0[ i ][ lane ] = static_cast<T>( tri.v0.pos[ i ] );
+		block.e1[ i ][ lane ] = static_cast<T>( tri.v1.pos[ i ] - tri.v0.pos[ i ] );
+		block.e2[ i ][ lane ] = static_cast<T>( tri.v2.pos[ i ] - tri.v0.pos[ i ] );
+		block.n[ i ][ lane ] = static_cast<T>( tri.n[ i ] );
+	}
+	block.triIx[ lane ] = triIx;
+}
+
+
+template<typename T>
+static void ClearBlockLane( triBlock_t<T>& block, const uint32_t lane )
+{
+	// Zero edges give a zero determinant, which the kernels reject
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		block.v0[ i ][ lane ] = T( 0 );
+		block.e1[ i ][ lane ] = T( 0 );
+		block.e2[ i ][ lane ] = T( 0 );
+		block.n[ i ][ lane ] = T( 0 );
+	}
+	block.triIx[ lane ] = 0;
+}
+
+
+template<typename T>
+void BuildTriangleSoA( const std::vector<Triangle>& triCache, const BVH<T>& bvh, triSoA_t<T>& soa )
+{
+	soa.blocks.clear();
+	soa.leafFirstBlock.assign( bvh.nodes.size(), 0 );
+
+	const size_t nodeCnt = bvh.nodes.size();
+	for ( size_t nodeIx = 0; nodeIx < nodeCnt; ++nodeIx )
+	{
+		const bvhNode_t<T>& node = bvh.nodes[ nodeIx ];
+		if ( node.count == 0 )
+		{
+			continue;
+		}
+
+		soa.leafFirstBlock[ nodeIx ] = static_cast<uint32_t>( soa.blocks.size() );
+
+		const uint32_t blockCnt = LeafBlockCount( node );
+		for ( uint32_t b = 0; b < blockCnt; ++b )
+		{
+			triBlock_t<T> block;
+			for ( uint32_t lane = 0; lane < TriBlockWidth; ++lane )
+			{
+				const uint32_t slot = b * TriBlockWidth + lane;
+				if ( slot < node.count )
+				{
+					const uint32_t triIx = bvh.indices[ node.offset + slot ];
+					SetBlockLane( block, lane, triCache[ triIx ], triIx );
+				}
+				else
+				{
+					ClearBlockLane( block, lane );
+				}
+			}
+			soa.blocks.push_back( block );
+		}
+	}
+}
+
+
+template void BuildTriangleSoA( const std::vector<Triangle>& triCache, const BVH<float>& bvh, triSoA_t<float>& soa );
+template void BuildTriangleSoA( const std::vector<Triangle>& triCache, const BVH<double>& bvh, triSoA_t<double>& soa );
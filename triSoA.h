@@ -0,0 +1,323 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <float.h>
+#include "../GfxCore/geom.h"
+#include "alignedAllocator.h"
+#include "intersect.h"
+#include "bvh.h"
+#include "packet.h"
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#define USE_SSE2_KERNEL	1
+#else
+#define USE_SSE2_KERNEL	0
+#endif
+
+static const uint32_t TriBlockWidth = 4;
+
+// Intersection-only triangle data, TriBlockWidth triangles per block. Shading data stays in triCache.
+template<typename T>
+struct alignas( CacheLineSize ) triBlock_t
+{
+	T			v0[ 3 ][ TriBlockWidth ];
+	T			e1[ 3 ][ TriBlockWidth ];	// v1 - v0
+	T			e2[ 3 ][ TriBlockWidth ];	// v2 - v0
+	T			n[ 3 ][ TriBlockWidth ];	// Face normal for backface classification
+	uint32_t	triIx[ TriBlockWidth ];		// Index into triCache. Padding lanes are degenerate and never hit.
+};
+
+
+// Blocks are laid out in BVH leaf order; each leaf owns ceil( count / TriBlockWidth ) blocks
+template<typename T>
+struct triSoA_t
+{
+	std::vector<triBlock_t<T>, AlignedAllocator<triBlock_t<T>>>	blocks;
+	std::vector<uint32_t>										leafFirstBlock;	// Indexed by BVH node
+};
+
+
+template<typename T>
+void BuildTriangleSoA( const std::vector<Triangle>& triCache, const BVH<T>& bvh, triSoA_t<T>& soa );
+
+
+template<typename T>
+inline uint32_t LeafBlockCount( const bvhNode_t<T>& leaf )
+{
+	return ( leaf.count + TriBlockWidth - 1 ) / TriBlockWidth;
+}
+
+
+#if USE_SSE2_KERNEL
+// Tests one ray against every triangle of a block. Returns a bit per lane that hits within tMax.
+inline uint32_t IntersectRayTriBlock( const traceRay_t<double>& ray, const triBlock_t<double>& block, const bool cullBackfaces, const double tMax, double t[ TriBlockWidth ], double u[ TriBlockWidth ], double v[ TriBlockWidth ] )
+{
+	uint32_t hitMask = 0;
+
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d one = _mm_set1_pd( 1.0 );
+	const __m128d eps = _mm_set1_pd( traceEpsilon_t<double>::HitT );
+	const __m128d baryMin = _mm_set1_pd( -traceEpsilon_t<double>::Barycentric );
+	const __m128d baryMax = _mm_set1_pd( 1.0 + traceEpsilon_t<double>::Barycentric );
+	const __m128d tLimit = _mm_set1_pd( tMax );
+
+	const __m128d dx = _mm_set1_pd( ray.d[ 0 ] );
+	const __m128d dy = _mm_set1_pd( ray.d[ 1 ] );
+	const __m128d dz = _mm_set1_pd( ray.d[ 2 ] );
+	const __m128d ox = _mm_set1_pd( ray.o[ 0 ] );
+	const __m128d oy = _mm_set1_pd( ray.o[ 1 ] );
+	const __m128d oz = _mm_set1_pd( ray.o[ 2 ] );
+
+	for ( uint32_t lane = 0; lane < TriBlockWidth; lane += 2 )
+	{
+		const __m128d e1x = _mm_load_pd( &block.e1[ 0 ][ lane ] );
+		const __m128d e1y = _mm_load_pd( &block.e1[ 1 ][ lane ] );
+		const __m128d e1z = _mm_load_pd( &block.e1[ 2 ][ lane ] );
+		const __m128d e2x = _mm_load_pd( &block.e2[ 0 ][ lane ] );
+		const __m128d e2y = _mm_load_pd( &block.e2[ 1 ][ lane ] );
+		const __m128d e2z = _mm_load_pd( &block.e2[ 2 ][ lane ] );
+
+		const __m128d sx = _mm_sub_pd( ox, _mm_load_pd( &block.v0[ 0 ][ lane ] ) );
+		const __m128d sy = _mm_sub_pd( oy, _mm_load_pd( &block.v0[ 1 ][ lane ] ) );
+		const __m128d sz = _mm_sub_pd( oz, _mm_load_pd( &block.v0[ 2 ][ lane ] ) );
+
+		const __m128d px = _mm_sub_pd( _mm_mul_pd( dy, e2z ), _mm_mul_pd( dz, e2y ) );
+		const __m128d py = _mm_sub_pd( _mm_mul_pd( dz, e2x ), _mm_mul_pd( dx, e2z ) );
+		const __m128d pz = _mm_sub_pd( _mm_mul_pd( dx, e2y ), _mm_mul_pd( dy, e2x ) );
+
+		const __m128d det = _mm_add_pd( _mm_add_pd( _mm_mul_pd( e1x, px ), _mm_mul_pd( e1y, py ) ), _mm_mul_pd( e1z, pz ) );
+		const __m128d invDet = _mm_div_pd( one, det );
+
+		const __m128d uu = _mm_mul_pd( _mm_add_pd( _mm_add_pd( _mm_mul_pd( sx, px ), _mm_mul_pd( sy, py ) ), _mm_mul_pd( sz, pz ) ), invDet );
+
+		const __m128d qx = _mm_sub_pd( _mm_mul_pd( sy, e1z ), _mm_mul_pd( sz, e1y ) );
+		const __m128d qy = _mm_sub_pd( _mm_mul_pd( sz, e1x ), _mm_mul_pd( sx, e1z ) );
+		const __m128d qz = _mm_sub_pd( _mm_mul_pd( sx, e1y ), _mm_mul_pd( sy, e1x ) );
+
+		const __m128d vv = _mm_mul_pd( _mm_add_pd( _mm_add_pd( _mm_mul_pd( dx, qx ), _mm_mul_pd( dy, qy ) ), _mm_mul_pd( dz, qz ) ), invDet );
+		const __m128d tt = _mm_mul_pd( _mm_add_pd( _mm_add_pd( _mm_mul_pd( e2x, qx ), _mm_mul_pd( e2y, qy ) ), _mm_mul_pd( e2z, qz ) ), invDet );
+
+		__m128d mask = _mm_cmpneq_pd( det, zero );
+		mask = _mm_and_pd( mask, _mm_cmpge_pd( uu, baryMin ) );
+		mask = _mm_and_pd( mask, _mm_cmple_pd( uu, baryMax ) );
+		mask = _mm_and_pd( mask, _mm_cmpge_pd( vv, baryMin ) );
+		mask = _mm_and_pd( mask, _mm_cmple_pd( _mm_add_pd( uu, vv ), baryMax ) );
+		mask = _mm_and_pd( mask, _mm_cmpgt_pd( tt, eps ) );
+		mask = _mm_and_pd( mask, _mm_cmple_pd( tt, tLimit ) );
+
+		if ( cullBackfaces )
+		{
+			const __m128d nx = _mm_load_pd( &block.n[ 0 ][ lane ] );
+			const __m128d ny = _mm_load_pd( &block.n[ 1 ][ lane ] );
+			const __m128d nz = _mm_load_pd( &block.n[ 2 ][ lane ] );
+			const __m128d facing = _mm_add_pd( _mm_add_pd( _mm_mul_pd( dx, nx ), _mm_mul_pd( dy, ny ) ), _mm_mul_pd( dz, nz ) );
+			mask = _mm_andnot_pd( _mm_cmpgt_pd( facing, zero ), mask );
+		}
+
+		_mm_storeu_pd( &t[ lane ], tt );
+		_mm_storeu_pd( &u[ lane ], uu );
+		_mm_storeu_pd( &v[ lane ], vv );
+		hitMask |= static_cast<uint32_t>( _mm_movemask_pd( mask ) ) << lane;
+	}
+
+	return hitMask;
+}
+
+
+// One SSE register holds the whole block in single precision
+inline uint32_t IntersectRayTriBlock( const traceRay_t<float>& ray, const triBlock_t<float>& block, const bool cullBackfaces, const float tMax, float t[ TriBlockWidth ], float u[ TriBlockWidth ], float v[ TriBlockWidth ] )
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 eps = _mm_set1_ps( traceEpsilon_t<float>::HitT );
+	const __m128 baryMin = _mm_set1_ps( -traceEpsilon_t<float>::Barycentric );
+	const __m128 baryMax = _mm_set1_ps( 1.0f + traceEpsilon_t<float>::Barycentric );
+	const __m128 tLimit = _mm_set1_ps( tMax );
+
+	const __m128 dx = _mm_set1_ps( ray.d[ 0 ] );
+	const __m128 dy = _mm_set1_ps( ray.d[ 1 ] );
+	const __m128 dz = _mm_set1_ps( ray.d[ 2 ] );
+	const __m128 ox = _mm_set1_ps( ray.o[ 0 ] );
+	const __m128 oy = _mm_set1_ps( ray.o[ 1 ] );
+	const __m128 oz = _mm_set1_ps( ray.o[ 2 ] );
+
+	const __m128 e1x = _mm_load_ps( &block.e1[ 0 ][ 0 ] );
+	const __m128 e1y = _mm_load_ps( &block.e1[ 1 ][ 0 ] );
+	const __m128 e1z = _mm_load_ps( &block.e1[ 2 ][ 0 ] );
+	const __m128 e2x = _mm_load_ps( &block.e2[ 0 ][ 0 ] );
+	const __m128 e2y = _mm_load_ps( &block.e2[ 1 ][ 0 ] );
+	const __m128 e2z = _mm_load_ps( &block.e2[ 2 ][ 0 ] );
+
+	const __m128 sx = _mm_sub_ps( ox, _mm_load_ps( &block.v0[ 0 ][ 0 ] ) );
+	const __m128 sy = _mm_sub_ps( oy, _mm_load_ps( &block.v0[ 1 ][ 0 ] ) );
+	const __m128 sz = _mm_sub_ps( oz, _mm_load_ps( &block.v0[ 2 ][ 0 ] ) );
+
+	const __m128 px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+	const __m128 py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+	const __m128 pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+
+	const __m128 det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py ) ), _mm_mul_ps( e1z, pz ) );
+	const __m128 invDet = _mm_div_ps( one, det );
+
+	const __m128 uu = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( sx, px ), _mm_mul_ps( sy, py ) ), _mm_mul_ps( sz, pz ) ), invDet );
+
+	const __m128 qx = _mm_sub_ps( _mm_mul_ps( sy, e1z ), _mm_mul_ps( sz, e1y ) );
+	const __m128 qy = _mm_sub_ps( _mm_mul_ps( sz, e1x ), _mm_mul_ps( sx, e1z ) );
+	const __m128 qz = _mm_sub_ps( _mm_mul_ps( sx, e1y ), _mm_mul_ps( sy, e1x ) );
+
+	const __m128 vv = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy ) ), _mm_mul_ps( dz, qz ) ), invDet );
+	const __m128 tt = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ), invDet );
+
+	__m128 mask = _mm_cmpneq_ps( det, zero );
+	mask = _mm_and_ps( mask, _mm_cmpge_ps( uu, baryMin ) );
+	mask = _mm_and_ps( mask, _mm_cmple_ps( uu, baryMax ) );
+	mask = _mm_and_ps( mask, _mm_cmpge_ps( vv, baryMin ) );
+	mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_add_ps( uu, vv ), baryMax ) );
+	mask = _mm_and_ps( mask, _mm_cmpgt_ps( tt, eps ) );
+	mask = _mm_and_ps( mask, _mm_cmple_ps( tt, tLimit ) );
+
+	if ( cullBackfaces )
+	{
+		const __m128 nx = _mm_load_ps( &block.n[ 0 ][ 0 ] );
+		const __m128 ny = _mm_load_ps( &block.n[ 1 ][ 0 ] );
+		const __m128 nz = _mm_load_ps( &block.n[ 2 ][ 0 ] );
+		const __m128 facing = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, nx ), _mm_mul_ps( dy, ny ) ), _mm_mul_ps( dz, nz ) );
+		mask = _mm_andnot_ps( _mm_cmpgt_ps( facing, zero ), mask );
+	}
+
+	_mm_storeu_ps( &t[ 0 ], tt );
+	_mm_storeu_ps( &u[ 0 ], uu );
+	_mm_storeu_ps( &v[ 0 ], vv );
+
+	return static_cast<uint32_t>( _mm_movemask_ps( mask ) );
+}
+#else
+// Tests one ray against every triangle of a block. Returns a bit per lane that hits within tMax.
+template<typename T>
+inline uint32_t IntersectRayTriBlock( const traceRay_t<T>& ray, const triBlock_t<T>& block, const bool cullBackfaces, const T tMax, T t[ TriBlockWidth ], T u[ TriBlockWidth ], T v[ TriBlockWidth ] )
+{
+	const T baryEps = traceEpsilon_t<T>::Barycentric;
+	uint32_t hitMask = 0;
+
+	for ( uint32_t lane = 0; lane < TriBlockWidth; ++lane )
+	{
+		const T sx = ray.o[ 0 ] - block.v0[ 0 ][ lane ];
+		const T sy = ray.o[ 1 ] - block.v0[ 1 ][ lane ];
+		const T sz = ray.o[ 2 ] - block.v0[ 2 ][ lane ];
+
+		const T px = ray.d[ 1 ] * block.e2[ 2 ][ lane ] - ray.d[ 2 ] * block.e2[ 1 ][ lane ];
+		const T py = ray.d[ 2 ] * block.e2[ 0 ][ lane ] - ray.d[ 0 ] * block.e2[ 2 ][ lane ];
+		const T pz = ray.d[ 0 ] * block.e2[ 1 ][ lane ] - ray.d[ 1 ] * block.e2[ 0 ][ lane ];
+
+		const T det = block.e1[ 0 ][ lane ] * px + block.e1[ 1 ][ lane ] * py + block.e1[ 2 ][ lane ] * pz;
+		const T invDet = T( 1 ) / det;
+
+		u[ lane ] = ( sx * px + sy * py + sz * pz ) * invDet;
+
+		const T qx = sy * block.e1[ 2 ][ lane ] - sz * block.e1[ 1 ][ lane ];
+		const T qy = sz * block.e1[ 0 ][ lane ] - sx * block.e1[ 2 ][ lane ];
+		const T qz = sx * block.e1[ 1 ][ lane ] - sy * block.e1[ 0 ][ lane ];
+
+		v[ lane ] = ( ray.d[ 0 ] * qx + ray.d[ 1 ] * qy + ray.d[ 2 ] * qz ) * invDet;
+		t[ lane ] = ( block.e2[ 0 ][ lane ] * qx + block.e2[ 1 ][ lane ] * qy + block.e2[ 2 ][ lane ] * qz ) * invDet;
+
+		const bool isBackface = ( ray.d[ 0 ] * block.n[ 0 ][ lane ] + ray.d[ 1 ] * block.n[ 1 ][ lane ] + ray.d[ 2 ] * block.n[ 2 ][ lane ] ) > T( 0 );
+
+		const bool hit =	( det != T( 0 ) ) &
+							( u[ lane ] >= -baryEps ) & ( u[ lane ] <= ( T( 1 ) + baryEps ) ) &
+							( v[ lane ] >= -baryEps ) & ( ( u[ lane ] + v[ lane ] ) <= ( T( 1 ) + baryEps ) ) &
+							( t[ lane ] > traceEpsilon_t<T>::HitT ) & ( t[ lane ] <= tMax ) &
+							!( cullBackfaces & isBackface );
+
+		hitMask |= ( hit ? 1u : 0u ) << lane;
+	}
+
+	return hitMask;
+}
+#endif
+
+
+// Closest hit within a block. Updates tMax and returns the winning lane, or TriBlockWidth on a miss.
+template<typename T>
+inline uint32_t ClosestHitTriBlock( const traceRay_t<T>& ray, const triBlock_t<T>& block, const bool cullBackfaces, T& tMax, T& u, T& v )
+{
+	T t[ TriBlockWidth ];
+	T bu[ TriBlockWidth ];
+	T bv[ TriBlockWidth ];
+	uint32_t hitMask = IntersectRayTriBlock( ray, block, cullBackfaces, tMax, t, bu, bv );
+
+	uint32_t closest = TriBlockWidth;
+	for ( uint32_t lane = 0; hitMask != 0; ++lane, hitMask >>= 1 )
+	{
+		if ( ( hitMask & 1 ) && ( t[ lane ] <= tMax ) )
+		{
+			tMax = t[ lane ];
+			u = bu[ lane ];
+			v = bv[ lane ];
+			closest = lane;
+		}
+	}
+	return closest;
+}
+
+
+// Same arithmetic as the single-ray block kernel, evaluated for every ray against one triangle of a block
+template<uint32_t N, typename T>
+inline void IntersectPacketTriangle( const rayPacket_t<N, T>& packet, const triBlock_t<T>& block, const uint32_t triLane, const uint32_t instanceIx, const bool cullBackfaces, packetHit_t<N, T>& hits )
+{
+	T e1[ 3 ];
+	T e2[ 3 ];
+	T v0[ 3 ];
+	T n[ 3 ];
+	for ( int32_t i = 0; i < 3; ++i )
+	{
+		e1[ i ] = block.e1[ i ][ triLane ];
+		e2[ i ] = block.e2[ i ][ triLane ];
+		v0[ i ] = block.v0[ i ][ triLane ];
+		n[ i ] = block.n[ i ][ triLane ];
+	}
+	const uint32_t triIx = block.triIx[ triLane ];
+	const T baryEps = traceEpsilon_t<T>::Barycentric;
+	for ( uint32_t lane = 0; lane < N; ++lane )
+	{
+		const T dx = packet.d[ 0 ][ lane ];
+		const T dy = packet.d[ 1 ][ lane ];
+		const T dz = packet.d[ 2 ][ lane ];
+
+		const T sx = packet.o[ 0 ][ lane ] - v0[ 0 ];
+		const T sy = packet.o[ 1 ][ lane ] - v0[ 1 ];
+		const T sz = packet.o[ 2 ][ lane ] - v0[ 2 ];
+
+		const T px = dy * e2[ 2 ] - dz * e2[ 1 ];
+		const T py = dz * e2[ 0 ] - dx * e2[ 2 ];
+		const T pz = dx * e2[ 1 ] - dy * e2[ 0 ];
+
+		const T det = e1[ 0 ] * px + e1[ 1 ] * py + e1[ 2 ] * pz;
+		const T invDet = T( 1 ) / det;
+
+		const T u = ( sx * px + sy * py + sz * pz ) * invDet;
+
+		const T qx = sy * e1[ 2 ] - sz * e1[ 1 ];
+		const T qy = sz * e1[ 0 ] - sx * e1[ 2 ];
+		const T qz = sx * e1[ 1 ] - sy * e1[ 0 ];
+
+		const T v = ( dx * qx + dy * qy + dz * qz ) * invDet;
+		const T t = ( e2[ 0 ] * qx + e2[ 1 ] * qy + e2[ 2 ] * qz ) * invDet;
+
+		const bool isBackface = ( dx * n[ 0 ] + dy * n[ 1 ] + dz * n[ 2 ] ) > T( 0 );
+
+		const bool hit =	( det != T( 0 ) ) &
+							( u >= -baryEps ) & ( u <= ( T( 1 ) + baryEps ) ) &
+							( v >= -baryEps ) & ( ( u + v ) <= ( T( 1 ) + baryEps ) ) &
+							( t > traceEpsilon_t<T>::HitT ) & ( t <= hits.t[ lane ] ) &
+							!( cullBackfaces & isBackface );
+
+		hits.t[ lane ] = hit ? t : hits.t[ lane ];
+		hits.u[ lane ] = hit ? u : hits.u[ lane ];
+		hits.v[ lane ] = hit ? v : hits.v[ lane ];
+		hits.triIx[ lane ] = hit ? triIx : hits.triIx[ lane ];
+		hits.instanceIx[ lane ] = hit ? instanceIx : hits.instanceIx[ lane ];
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include "../GfxCore/geom.h"
+#include "../GfxCore/color.h"
+#include "globals.h"
+#include "intersect.h"
+
+static const uint32_t WavefrontChunkSize = 1024;	// Queue entries per thread pool task
+
+// Per-path state, indexed by path. A path is one subsample of one pixel and lives for a whole wave.
+struct pathState_t
+{
+	std::vector<uint32_t>	px;
+	std::vector<uint32_t>	py;
+	std::vector<sample_t>	sample;		// Attributes of the primary hit; color gathers the path's radiance
+	std::vector<double>		throughput;	// Product of mirror transmission along the path
+
+	void Resize( const uint32_t pathCnt )
+	{
+		px.resize( pathCnt );
+		py.resize( pathCnt );
+		sample.resize( pathCnt );
+		throughput.resize( pathCnt );
+	}
+};
+
+
+// Structure-of-arrays ray queue. Stages append through an atomic cursor, so rays that survive
+// a stage end up compacted at the front of the next queue.
+struct rayQueue_t
+{
+	std::vector<double>		o[ 3 ];
+	std::vector<double>		d[ 3 ];
+	std::vector<uint32_t>	pathIx;
+	std::atomic<uint32_t>	count;
+
+	void Reserve( const uint32_t capacity )
+	{
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			o[ i ].resize( capacity );
+			d[ i ].resize( capacity );
+		}
+		pathIx.resize( capacity );
+		count = 0;
+	}
+
+	void Push( const Ray& ray, const uint32_t path )
+	{
+		const uint32_t slot = count++;
+		const vec3d dir = ray.GetVector();
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			o[ i ][ slot ] = ray.o[ i ];
+			d[ i ][ slot ] = dir[ i ];
+		}
+		pathIx[ slot ] = path;
+	}
+
+	Ray GetRay( const uint32_t slot ) const
+	{
+		const vec3d origin = vec3d( o[ 0 ][ slot ], o[ 1 ][ slot ], o[ 2 ][ slot ] );
+		const vec3d dir = vec3d( d[ 0 ][ slot ], d[ 1 ][ slot ], d[ 2 ][ slot ] );
+
+		Ray ray = Ray( origin, origin + dir );
+		ray.d = dir; // Exact direction; ( origin + dir ) - origin may round
+		return ray;
+	}
+};
+
+
+// Closest hits of the extend stage, parallel to the ray queue that produced them
+template<typename T>
+struct hitQueue_t
+{
+	std::vector<T>			t;
+	std::vector<T>			u;
+	std::vector<T>			v;
+	std::vector<uint32_t>	triIx;
+	std::vector<uint32_t>	instanceIx;
+
+	void Reserve( const uint32_t capacity )
+	{
+		t.resize( capacity );
+		u.resize( capacity );
+		v.resize( capacity );
+		triIx.resize( capacity );
+		instanceIx.resize( capacity );
+	}
+};
+
+
+// Shadow rays toward the lights selected for each shaded path, lightCnt consecutive entries per path.
+// Each entry carries the light's weighted contribution, kept only if the segment is unoccluded.
+struct shadowQueue_t
+{
+	std::vector<double>		o[ 3 ];
+	std::vector<uint32_t>	lightIx;
+	std::vector<Color>		contribution;
+	std::vector<uint8_t>	visible;
+	std::vector<uint32_t>	pathIx;		// One per group of lightCnt entries
+	std::vector<Color>		ambient;	// One per group of lightCnt entries
+	std::atomic<uint32_t>	groupCnt;
+
+	void Reserve( const uint32_t pathCapacity, const uint32_t lightCnt )
+	{
+		const uint32_t capacity = pathCapacity * lightCnt;
+		for ( int32_t i = 0; i < 3; ++i )
+		{
+			o[ i ].resize( capacity );
+		}
+		lightIx.resize( capacity );
+		contribution.resize( capacity );
+		visible.resize( capacity );
+		pathIx.resize( pathCapacity );
+		ambient.resize( pathCapacity );
+		groupCnt = 0;
+	}
+};